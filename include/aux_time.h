@@ -10,9 +10,14 @@
 #ifndef AUX_TIME_H_
 #define AUX_TIME_H_
 
+#include <cstdint>
 #include <ctime>
 #include <iostream>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 
 
 //#define __USE_GETTIMEOFDAY
@@ -32,5 +37,69 @@ long getclock_diff_us(my_clock clk1, my_clock clk2);
 long getclock_diff_ns(my_clock clk1, my_clock clk2);
 double getclock_diff_s(my_clock clk1, my_clock clk2);
 
+/*
+ * Low-overhead timer for per-op latencies. On x86 with an invariant TSC the
+ * ticks are TSC cycles, read with fences so the timed op can not move out of
+ * the interval; otherwise they are CLOCK_MONOTONIC ns. Ticks are turned into
+ * ns (minus the timer's own measured overhead) by my_ticks_to_ns only.
+ * Call my_ticks_calibrate once at startup; until then the fallback is used.
+ */
+typedef uint64_t my_ticks;
+
+struct my_ticks_calibration_t {
+	bool use_tsc;
+	// ns = ticks * mult >> 32
+	uint64_t mult;
+	// ticks of an empty start/stop pair
+	uint64_t overhead;
+};
+extern my_ticks_calibration_t my_ticks_calibration;
+
+void my_ticks_calibrate();
+double my_ticks_overhead_ns();
+
+static inline my_ticks my_ticks_monotonic()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline my_ticks my_ticks_start()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (my_ticks_calibration.use_tsc) {
+		// earlier instructions finish before the read, later ones wait for it
+		_mm_lfence();
+		my_ticks ticks = __rdtsc();
+		_mm_lfence();
+		return ticks;
+	}
+#endif
+	return my_ticks_monotonic();
+}
+
+static inline my_ticks my_ticks_stop()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (my_ticks_calibration.use_tsc) {
+		// rdtscp waits for the timed op to finish
+		unsigned int aux;
+		my_ticks ticks = __rdtscp(&aux);
+		_mm_lfence();
+		return ticks;
+	}
+#endif
+	return my_ticks_monotonic();
+}
+
+static inline uint64_t my_ticks_to_ns(my_ticks elapsed)
+{
+	elapsed = elapsed > my_ticks_calibration.overhead
+	              ? elapsed - my_ticks_calibration.overhead
+	              : 0;
+	return (uint64_t)(((unsigned __int128)elapsed * my_ticks_calibration.mult) >> 32);
+}
+
 
 #endif /* AUX_TIME_H_ */
@@ -1,27 +1,160 @@
 #ifndef STATS_BUFFER_H_
 #define STATS_BUFFER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
 #include <csignal>
-#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
 #include <iostream>
-#include <list>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+/**
+ * Log file writer. Every thread formats into a record queue of its own, and a
+ * collector thread merges the queues in timestamp order, so background
+ * listeners and the replay thread never take a common lock to log. The
+ * collector sleeps until a queue is half full or `flush` is called. A record
+ * ends with a newline; a multi-line string stays one record.
+ *
+ * The merged records go into one of `num_arenas` fixed-size arenas; a full
+ * arena is handed to a writer thread that writes it out while the next one
+ * fills. This is what `SetMemoryMapped(false)` and compressed Buffers do; by
+ * default the collector is bypassed: a finished line reserves its bytes in
+ * the file and is copied straight into a mapped window, so it is in the page
+ * cache before `<<` returns and survives the process being killed; see
+ * `handle_signal`.
+ *
+ * With `SetCompression(level)` the writer thread zstd-compresses every arena
+ * into one streaming frame and the file gets a `.zst` suffix; `LogReader`
+ * (and the `log_cat` tool) read it back. Needs a build with `-DWITH_ZSTD=ON`.
+ */
 class Buffer {
 private:
-  std::stringstream buffer;
-  std::ofstream output_file;
+  // single producer (the owning thread), single consumer (the collector)
+  struct ThreadLog {
+    static const size_t kCapacity = 1024;
+    struct Record {
+      uint64_t ts_ns;
+      std::string text;
+    };
+    std::vector<Record> ring{kCapacity};
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    // producer only: the record being formatted and the stream state of
+    // setw, setprecision, ... for the types the fast path does not format
+    std::string line;
+    std::unique_ptr<std::ostringstream> scratch;
+  };
+  struct PendingRecord {
+    uint64_t ts_ns;
+    uint64_t seq;
+    std::string text;
+    bool operator>(const PendingRecord &other) const {
+      return ts_ns != other.ts_ns ? ts_ns > other.ts_ns : seq > other.seq;
+    }
+  };
+
+  struct Arena {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+  };
+
+  int fd_ = -1;
   size_t buffer_limit;
 
-  static std::list<Buffer *> instances_;
-  static std::mutex mutex_;
+  // writer thread only: streaming compression of the arenas, nullptr when
+  // the file is plain text
+  void *cctx_ = nullptr;
+  std::vector<char> compressed_;
+
+  // memory-mapped mode: writers reserve bytes with a fetch_add on
+  // `end_offset_` and copy into window `offset / window_size_`; windows are
+  // mapped on first use and stay mapped until the Buffer is destroyed
+  static const size_t kMaxWindows = 1 << 14;
+  bool mapped_ = false;
+  size_t window_size_ = 0;
+  std::unique_ptr<std::atomic<char *>[]> windows_;
+  std::mutex map_mutex_;
+  size_t file_size_ = 0;
+  std::atomic<size_t> end_offset_{0};
+  // set once the windows are used up and lines are being dropped
+  std::atomic<bool> overflowed_{false};
+
+  std::vector<Arena> arenas_;
+  Arena *active_ = nullptr;
+  std::deque<Arena *> free_;
+  std::deque<Arena *> full_;
+  size_t writing_ = 0;
+  // arenas sealed but not yet written, read by the signal handler
+  std::atomic<size_t> pending_{0};
+  bool stop_ = false;
+  std::mutex append_mutex_;
+  std::condition_variable writer_cv_;
+  std::condition_variable free_cv_;
+  std::thread writer_;
+
+  // never reused, keys the per-thread lookup of the ThreadLog
+  uint64_t id_;
+  std::mutex logs_mutex_;
+  std::vector<std::unique_ptr<ThreadLog>> logs_;
+
+  std::mutex collector_mutex_;
+  std::condition_variable collector_cv_;
+  std::condition_variable collected_cv_;
+  uint64_t flush_requests_ = 0;
+  uint64_t flushes_done_ = 0;
+  // a ring is half full
+  bool collect_requested_ = false;
+  bool stop_collector_ = false;
+  std::thread collector_;
+  // collector only; written records leave their emptied strings in
+  // `spare_texts_` to be swapped back into the ring slots
+  std::vector<PendingRecord> pending_records_;
+  std::vector<std::string> spare_texts_;
+  uint64_t next_seq_ = 0;
+
+  static std::atomic<uint64_t> next_id_;
+  static const std::ios_base::fmtflags kDefaultFlags;
+  static const std::streamsize kDefaultPrecision = 6;
+
+  // fixed slots so the signal handler can walk them without locking
+  static const int kMaxInstances = 16;
+  static std::atomic<Buffer *> instances_[kMaxInstances];
+  static bool use_mmap_;
+  static int compression_level_;
 
   static void handle_signal(int signal);
 
+  ThreadLog *Local();
+  ThreadLog *Lookup();
+  void Commit(ThreadLog *log);
+  void WakeCollector();
+  void CollectorLoop();
+  void Collect(bool everything);
+  std::ostringstream &Scratch(ThreadLog *log);
+
+  void Append(const char *data, size_t len);
+  void SealActive();
+  void WriterLoop();
+  char *Window(size_t index);
+  void WriteMapped(const char *data, size_t len);
+  void WriteAll(const char *data, size_t len);
+  void WriteCompressed(const char *data, size_t len, bool end);
+  void SignalFlush();
+
 public:
-  Buffer(const std::string &filename, size_t limit = 10 * 1024 * 1024);
+  Buffer(const std::string &filename, size_t limit = 10 * 1024 * 1024,
+         size_t num_arenas = 2);
 
   ~Buffer();
 
@@ -29,19 +162,85 @@ public:
 
   Buffer &operator<<(std::ostream &(*manip)(std::ostream &));
 
+  /**
+   * Blocks until everything appended so far is in the file
+   */
   void flush();
 
+  /**
+   * Makes Buffers created afterwards write through a memory-mapped file,
+   * the default
+   */
+  static void SetMemoryMapped(bool mapped) { use_mmap_ = mapped; }
+
+  /**
+   * Makes Buffers created afterwards write zstd at `level`, 0 for plain text
+   */
+  static void SetCompression(int level) { compression_level_ = level; }
+
   void register_instance();
   void unregister_instance();
   void register_signals();
 };
 
+inline Buffer::ThreadLog *Buffer::Local() {
+  thread_local uint64_t cached_id = 0;
+  thread_local ThreadLog *cached_log = nullptr;
+  if (cached_id != id_) {
+    cached_log = Lookup();
+    cached_id = id_;
+  }
+  return cached_log;
+}
+
 template <typename T> Buffer &Buffer::operator<<(const T &data) {
-  buffer << data;
-  if (buffer.tellp() >= static_cast<std::streampos>(buffer_limit)) {
-    flush();
+  ThreadLog *log = Local();
+  std::ostringstream *scratch = log->scratch.get();
+  bool plain = !scratch || scratch->width() == 0;
+  bool plain_number = !scratch || (plain && scratch->flags() == kDefaultFlags &&
+                                   scratch->precision() == kDefaultPrecision);
+  if constexpr (std::is_same_v<T, char>) {
+    if (plain) {
+      log->line.push_back(data);
+      if (data == '\n') {
+        Commit(log);
+      }
+      return *this;
+    }
+  } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+    if (plain) {
+      std::string_view view(data);
+      log->line.append(view.data(), view.size());
+      if (!view.empty() && view.back() == '\n') {
+        Commit(log);
+      }
+      return *this;
+    }
+  } else if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+    if (plain_number) {
+      char digits[24];
+      auto res = std::to_chars(digits, digits + sizeof(digits), data);
+      log->line.append(digits, res.ptr - digits);
+      return *this;
+    }
+  } else if constexpr (std::is_floating_point_v<T>) {
+    if (plain_number) {
+      // same output as the default ostream float format
+      char digits[32];
+      int len = std::snprintf(digits, sizeof(digits), "%.*g",
+                              (int)kDefaultPrecision, (double)data);
+      log->line.append(digits, std::min<size_t>(len, sizeof(digits) - 1));
+      return *this;
+    }
+  }
+  std::ostringstream &stream = Scratch(log);
+  stream.str("");
+  stream << data;
+  log->line += stream.str();
+  if (!log->line.empty() && log->line.back() == '\n') {
+    Commit(log);
   }
   return *this;
 }
 
-#endif // STATS_BUFFER_H_
\ No newline at end of file
+#endif // STATS_BUFFER_H_
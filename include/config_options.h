@@ -4,6 +4,7 @@
 #include <rocksdb/iostats_context.h>
 #include <rocksdb/options.h>
 #include <rocksdb/perf_context.h>
+#include <rocksdb/rate_limiter.h>
 #include <rocksdb/statistics.h>
 #include <rocksdb/table.h>
 #include <rocksdb/slice_transform.h>
@@ -12,6 +13,8 @@
 #include "db_env.h"
 #include "event_listners.h"
 #include "fluid_lsm.h"
+#include "monkey_filter_policy.h"
+#include "tombstone_collector.h"
 
 inline void configOptions(std::unique_ptr<DBEnv> &env, Options *options,
                    BlockBasedTableOptions *table_options,
@@ -55,6 +58,23 @@ inline void configOptions(std::unique_ptr<DBEnv> &env, Options *options,
   
   if (env->bits_per_key == 0) {
     ; // do nothing
+  } else if (env->monkey_filters && env->num_inserts == 0) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: Monkey filters need the number of inserts (-I), "
+                 "falling back to uniform bits per key" << std::endl;
+    table_options->filter_policy.reset(
+        NewBloomFilterPolicy(env->bits_per_key, false));
+  } else if (env->monkey_filters) {
+    // same total filter memory as the uniform policy, spread per level
+    int fluid_k = env->enable_fluid_lsm ? env->smaller_lvl_runs_count : 0;
+    std::vector<double> entries = MonkeyFilterPolicy::ExpectedEntriesPerLevel(
+        env->num_levels, (double)env->GetBufferSize() / env->entry_size,
+        env->size_ratio, env->num_inserts,
+        fluid_k > 0 ? fluid_k
+                    : std::max(env->level0_file_num_compaction_trigger, 1),
+        fluid_k);
+    table_options->filter_policy = std::make_shared<MonkeyFilterPolicy>(
+        entries, env->bits_per_key * env->num_inserts, env->bits_per_key);
   } else {
     // currently build full filter instead of block-based filter
     table_options->filter_policy.reset(
@@ -158,6 +178,15 @@ inline void configOptions(std::unique_ptr<DBEnv> &env, Options *options,
   options->hard_pending_compaction_bytes_limit =
       env->hard_pending_compaction_bytes_limit;
   options->periodic_compaction_seconds = env->periodic_compaction_seconds;
+  if (env->rate_limit_mb > 0 || env->rate_limit_p99_us > 0) {
+    // the auto-tuner starts from the static budget, or from a budget high
+    // enough not to throttle anything until latency rises
+    int64_t bytes_per_sec =
+        (env->rate_limit_mb > 0 ? env->rate_limit_mb : 1024) * 1024 * 1024;
+    options->rate_limiter.reset(NewGenericRateLimiter(
+        bytes_per_sec, 100 * 1000 /* refill_period_us */, 10 /* fairness */,
+        RateLimiter::Mode::kWritesOnly));
+  }
   options->use_direct_io_for_flush_and_compaction =
       env->use_direct_io_for_flush_and_compaction;
   options->use_direct_reads = env->use_direct_reads;
@@ -357,13 +386,28 @@ inline void configOptions(std::unique_ptr<DBEnv> &env, Options *options,
 #endif // PROFILE
   }
 
+  // tombstone counts and ages of every SST, see Stats::fade_file_info
+  options->table_properties_collector_factories.emplace_back(
+      std::make_shared<TombstoneCollectorFactory>());
+
   // NOTE: Keep this block in last of this file
-#ifdef DOSTO
-  std::shared_ptr<FluidLSM> tree = std::make_shared<FluidLSM>(
-      env->size_ratio, env->smaller_lvl_runs_count, env->larger_lvl_runs_count,
-      env->GetTargetFileSizeBase(), options);
-  options->listeners.emplace_back(tree);
-#endif // DOSTO
+  if (env->enable_fluid_lsm) {
+    // FluidLSM schedules every compaction itself, RocksDB only flushes
+    options->compaction_style = CompactionStyle::kCompactionStyleNone;
+    options->disable_auto_compactions = true;
+    options->num_levels = env->num_levels;
+
+    // lets FluidLSM place new files from the flush/compaction events alone
+    options->table_properties_collector_factories.emplace_back(
+        std::make_shared<KeyRangeCollectorFactory>());
+    std::shared_ptr<FluidLSM> tree = std::make_shared<FluidLSM>(
+        env->size_ratio, env->smaller_lvl_runs_count,
+        env->larger_lvl_runs_count, env->GetTargetFileSizeBase(), *options,
+        env->max_parallel_compactions);
+    tree->SetDebugMode(env->fluid_debug);
+    tree->SetPartialCompactions(env->partial_compaction_bytes);
+    options->listeners.emplace_back(tree);
+  }
 }
 
 #endif // CONFIG_OPTIONS_H
\ No newline at end of file
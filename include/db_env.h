@@ -90,6 +90,11 @@ public:
   }
 
   bool run_sample_workload = false;
+  // simulate ingesting this many bytes on a metadata-only LSM model instead
+  // of running the workload (0 turns it off)
+  uint64_t simulate_bytes = 0;
+  // simulated keys arrive in order instead of uniformly at random
+  bool simulate_sequential = false;
   int kv_entry_size = 8;
   float key_value_size_ratio = 0.5;
   int num_kv_entries = 20000;
@@ -153,6 +158,9 @@ public:
 
   // bloom filter bits per key
   double bits_per_key = 10; // [b]
+  // spread the bits of all keys across levels to minimize the sum of FPRs
+  // (Monkey) instead of giving every level `bits_per_key`
+  bool monkey_filters = false;
 
   /**
    * Compaction Priority
@@ -206,6 +214,35 @@ public:
   // another for flush
   int max_background_jobs = 1;
 
+  // replace RocksDB's compaction picker with FluidLSM (Dostoevsky lazy
+  // leveling), runs per level are bounded by K and by Z at the largest level
+  bool enable_fluid_lsm = false;
+  int smaller_lvl_runs_count = 1; // [K]
+  int larger_lvl_runs_count = 1;  // [Z]
+  // print the FluidLSM view and every compaction it schedules
+  bool fluid_debug = false;
+  /**
+   * FluidLSM Tuner
+   * 0 for off
+   * 1 for printing the best (T, K, Z) for the op mix of workload.txt
+   * 2 for applying the best (T, K, Z) for the online op mix
+   */
+  uint16_t fluid_tune = 0;
+  // number of ops between two online tuning decisions
+  long fluid_tune_interval = 100000;
+
+  // compact FluidLSM levels as a stream of key-range slices of about this
+  // many bytes instead of one job per level (0 turns it off)
+  long partial_compaction_bytes = 0;
+
+  // maximum number of FluidLSM compactions running at the same time, each
+  // on a disjoint set of lazy levels
+  int max_parallel_compactions = 1;
+
+  // after every compaction check that 1 in N written keys still reads back
+  // its last written value (0 turns the check off)
+  long verify_compactions = 0;
+
   // No pending compaction anytime, try and see
   int soft_pending_compaction_bytes_limit = 0;
   int hard_pending_compaction_bytes_limit = 0;
@@ -213,6 +250,14 @@ public:
   // turn off periodic compactions
   uint64_t periodic_compaction_seconds = 0;
 
+  // cap on flush and compaction writes in MB/s (0 for no limit); with
+  // `rate_limit_p99_us` it is the budget the auto-tuner starts from
+  long rate_limit_mb = 0;
+  // foreground p99 (us) the rate limiter auto-tuner aims for (0 for off)
+  long rate_limit_p99_us = 0;
+  // number of ops the auto-tuner looks at between two adjustments
+  long rate_limit_window = 10000;
+
   // use O_DIRECT for writes in background flush and compactions.
   bool use_direct_io_for_flush_and_compaction = true;
   // enable direct I/O mode for read/write. Files will be opened in "direct I/O"
@@ -433,6 +478,37 @@ public:
 
   // refer memtable.h (VectorRepFactory)
   size_t vector_preallocation_size_in_bytes = Default::VECTOR_PREALLOCATION_SIZE_IN_BYTES;
+
+  // switch the memtable representation online based on the observed op mix
+  // and the cost model in sample_workload.stat (see MemtableSwitchController)
+  bool adaptive_memtable = false;
+  // number of most recent ops the op mix is computed over
+  size_t adaptive_window_size = 10000;
+  // minimum estimated relative gain required to switch representation
+  double adaptive_min_gain = 0.1;
+  // account conversion time, memory and write latency of every switch
+  bool switch_cost_tracking = false;
+  // period (ms) of the live Stats snapshots in stats_live.log, 0 for only
+  // the final one in workload.log
+  long stats_interval_ms = 0;
+  // delete persistence threshold in seconds (FADE), -1 for off
+  double delete_persistence_threshold = -1;
+  // log every write stall with its cause and the ops it slowed down
+  bool track_stalls = false;
+  // Chrome trace (Perfetto) timeline written at the end of the run, empty
+  // for off
+  std::string trace_file = "";
+  // keep 1 in this many foreground ops in the timeline
+  long trace_sample_rate = 100;
+  // write the logs through a memory-mapped file so they survive the run
+  // being killed
+  bool mmap_logs = true;
+  // zstd level the log files are compressed with, 0 for plain text
+  int compress_logs = 0;
+  // read hardware counters around 1 in this many ops, 0 for off
+  long perf_counters = 0;
+  // time and log 1 in this many ops (picked at random), 1 for all
+  long latency_sample_rate = 1;
 #pragma endregion  // LSMMemoryBuffer
 };
 
@@ -1,7 +1,13 @@
 #ifndef EVENT_LISTNER_H_
 #define EVENT_LISTNER_H_
 
+#include <atomic>
 #include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <rocksdb/db.h>
 
@@ -9,45 +15,65 @@
 
 using namespace rocksdb;
 
-extern std::mutex mtx;
-extern std::condition_variable cv;
-extern bool compaction_complete;
-
 /*
- * Wait for compactions that are running (or will run) to make the
- * LSM tree in its shape. Check `CompactionListner` for more details.
+ * Wait for flushes and compactions that are running (or will run) to make
+ * the LSM tree in its shape. Uses the `CompactionsListner` registered with
+ * `db`, check it for more details.
  */
 void WaitForCompactions(DB *db);
 
 /*
  * The compactions can run in background even after the workload is completely
- * executed so, we have to wait for them to complete. Compaction Listener gets
- * notified by the rocksdb API for every compaction that just finishes off.
- * After every compaction we check, if more compactions are required with
- * `WaitForCompaction` function, if not then it signals to close the db
+ * executed so, we have to wait for them to complete. This listener tracks
+ * the quiescence of the DB it is registered with: it counts the flushes and
+ * compactions between their begin and completion events, and `WaitForIdle`
+ * sleeps until an event leaves none running and the DB reports no pending
+ * flush or compaction. Nothing is latched, so it can be waited on again
+ * between the phases of a run.
  */
 class CompactionsListner : public EventListener {
 public:
   explicit CompactionsListner() {}
 
-  void OnCompactionCompleted(DB *db, const CompactionJobInfo &ci) override {
-    std::lock_guard<std::mutex> lock(mtx);
-    uint64_t num_running_compactions;
-    uint64_t pending_compaction_bytes;
-    uint64_t num_pending_compactions;
-    db->GetIntProperty("rocksdb.num-running-compactions",
-                       &num_running_compactions);
-    db->GetIntProperty("rocksdb.estimate-pending-compaction-bytes",
-                       &pending_compaction_bytes);
-    db->GetIntProperty("rocksdb.compaction-pending", &num_pending_compactions);
-    if (num_running_compactions == 0 && pending_compaction_bytes == 0 &&
-        num_pending_compactions == 0) {
-      compaction_complete = true;
-    }
-    cv.notify_one();
+  void OnFlushBegin(DB *db, const FlushJobInfo &fji) override;
+  void OnFlushCompleted(DB *db, const FlushJobInfo &fji) override;
+  void OnCompactionBegin(DB *db, const CompactionJobInfo &ci) override;
+  void OnCompactionCompleted(DB *db, const CompactionJobInfo &ci) override;
+  void OnBackgroundError(BackgroundErrorReason reason,
+                         Status *bg_error) override;
+
+  /**
+   * Work scheduled outside of RocksDB's picker (e.g. FluidLSM), which
+   * calls `Notify` whenever it may have become idle
+   */
+  void SetPendingWorkCheck(std::function<bool()> check) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    external_pending_ = check;
   }
+
+  void Notify();
+
+  void WaitForIdle(DB *db);
+
+private:
+  bool HasPendingWork(DB *db);
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int running_flushes_ = 0;
+  int running_compactions_ = 0;
+  uint64_t events_ = 0;  // bumped by every event, wakes the waiters
+  std::function<bool()> external_pending_;
 };
 
+/*
+ * Logs one `[Flush]` record per flush with the memtable rep, the configured
+ * buffer size, the arena bytes the memtable actually took, the user bytes
+ * (raw key + raw value) and entries it held when it was sealed and the
+ * resulting fill efficiency, next to the same counts of the output SST
+ * (after dedup), the flush reason and the immutable memtable queue depth.
+ * Without a buffer (sample workload) it only times the flushes.
+ */
 class FlushListner : public EventListener {
 public:
   explicit FlushListner(std::shared_ptr<Buffer> &buffer) {
@@ -58,10 +84,11 @@ public:
   }
 
   inline auto GetNumFlush() {
-    assert(job_end_time.size() == job_end_time.size());
+    std::lock_guard<std::mutex> lock(mutex_);
     return job_start_time.size();
   }
   inline auto GetFlushDurations() {
+    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<int64_t> durations;
     for (auto it: job_start_time) {
       if (job_end_time.find(it.first) != job_end_time.end()) {
@@ -76,8 +103,56 @@ public:
 
   void OnFlushBegin(DB* db, const FlushJobInfo& fji) override;
 
+  void OnMemTableSealed(const MemTableInfo& info) override;
+
+  /**
+   * Counts the user bytes of a successful write towards the active memtable
+   */
+  inline void RecordWrite(uint64_t user_bytes) {
+    written_bytes_.fetch_add(user_bytes, std::memory_order_relaxed);
+  }
+
+  /**
+   * Names the rep of the active memtable when it is sealed. Without a
+   * source every flush is charged to the configured memtable factory.
+   */
+  void SetRepSource(std::function<std::string()> rep_source) {
+    rep_source_ = std::move(rep_source);
+  }
+
+  /**
+   * Average fill efficiency per memtable rep
+   */
+  void PrintSummary();
+
 private:
+  // memtable state seen when the flush started
+  struct FlushStart {
+    uint64_t avg_arena_bytes; // averaged over the immutable memtables
+    uint64_t immutable_memtables;
+  };
+  // what a memtable held when it was sealed
+  struct SealedMemTable {
+    std::string rep; // empty without a rep source
+    uint64_t entries;
+    uint64_t deletes;
+    uint64_t user_bytes;
+  };
+  struct FillTotals {
+    long flushes = 0;
+    double fill = 0;
+    double arena_fill = 0;
+  };
+
+  std::mutex mutex_;
   std::shared_ptr<Buffer> buffer_;
+  std::unordered_map<int, FlushStart> flush_start_;
+  std::function<std::string()> rep_source_;
+  // every sealed memtable not yet flushed, by its first seqno
+  std::map<SequenceNumber, SealedMemTable> sealed_;
+  // user bytes written since the last seal
+  std::atomic<uint64_t> written_bytes_{0};
+  std::map<std::string, FillTotals> fill_by_rep_;
   std::unordered_map<int, std::chrono::steady_clock::time_point> job_start_time;
   std::unordered_map<int, std::chrono::steady_clock::time_point> job_end_time;
 };
@@ -0,0 +1,99 @@
+#ifndef FADE_CONTROLLER_H_
+#define FADE_CONTROLLER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <rocksdb/db.h>
+#include <rocksdb/listener.h>
+
+#include "buffer.h"
+#include "fluid_lsm.h"
+#include "latency_histogram.h"
+
+using namespace rocksdb;
+
+/**
+ * FADE: bounds how long a delete can stay logically applied but physically
+ * present. The threshold `dpth` is split over the levels geometrically by
+ * the size ratio, so level i must hand a tombstone down within
+ * dpth * (T^(i+1) - 1) / (T^L - 1) of its write. A background thread reads
+ * the tombstone ages of every file (see `TombstoneCollector`), again only
+ * after a flush or compaction finished, and compacts the file that is
+ * furthest past its level's deadline, through FluidLSM when it runs the
+ * compactions and CompactFiles otherwise.
+ *
+ * The delete persistence latency (Delete to physical purge) is measured on
+ * 1 in `kSampleEvery` deleted keys by looking for their tombstone with
+ * GetAllKeyVersions after compactions.
+ */
+class FadeController : public EventListener {
+ public:
+  static const int kSampleEvery = 16;
+  static const size_t kMaxTracked = 100000;
+  static const size_t kMaxChecksPerRound = 10000;
+
+  FadeController(double threshold_s, double size_ratio,
+                 std::shared_ptr<FluidLSM> tree,
+                 std::shared_ptr<Buffer> &buffer);
+  ~FadeController();
+
+  /**
+   * Called by the replay thread right after a successful Delete
+   */
+  void RecordDelete(DB *db, const std::string &key);
+
+  void OnFlushCompleted(DB *db, const FlushJobInfo &fji) override;
+
+  void OnCompactionCompleted(DB *db, const CompactionJobInfo &ci) override;
+
+  void Start(DB *db);
+  void Stop();
+
+  void PrintSummary();
+
+ private:
+  struct TrackedTombstone {
+    std::string key;
+    SequenceNumber seqno;
+    uint64_t time_micros;
+  };
+
+  void Run(DB *db);
+  void CheckPurged(DB *db);
+  void CompactExpired(DB *db);
+
+  // FluidLSM ages tombstones per lazy level, RocksDB per level
+  int LogicalLevel(int RocksDB_lvl) const;
+  double LevelDeadline(int lvl, int num_levels) const;
+
+  double threshold_s_;
+  double size_ratio_;
+  std::shared_ptr<FluidLSM> tree_;
+  std::shared_ptr<Buffer> buffer_;
+
+  std::mutex tracked_mutex_;
+  std::deque<TrackedTombstone> tracked_;
+  long dropped_samples_ = 0;
+
+  std::atomic<bool> compaction_completed_{false};
+  // the file list only changes with a flush or compaction
+  std::atomic<bool> tree_changed_{true};
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+
+  // background thread only, read after Stop
+  LatencyHistogram persistence_latency_ms_;
+  long triggered_compactions_ = 0;
+  long failed_compactions_ = 0;
+  long overdue_checks_ = 0;  // checks that found a file past its deadline
+};
+
+#endif // FADE_CONTROLLER_H_
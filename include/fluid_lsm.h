@@ -1,12 +1,22 @@
+#ifndef FLUID_LSM_H_
+#define FLUID_LSM_H_
+
 #include <rocksdb/db.h>
 #include <rocksdb/listener.h>
 #include <rocksdb/rocksdb_namespace.h>
+#include <rocksdb/table_properties.h>
 
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <mutex>
+#include <queue>
 #include <set>
+#include <string>
 #include <vector>
 
+#include "latency_histogram.h"
+
 namespace ROCKSDB_NAMESPACE {
 
 class FluidLSM;
@@ -18,20 +28,32 @@ struct CompactionTask {
   CompactionTask(DB* db, FluidLSM* compactor, const std::string& cf_name,
                  const std::vector<std::string>& input_file_names,
                  const int output_lvl, const CompactionOptions& compact_options,
-                 bool retry_on_fail, bool debug_mode)
+                 bool retry_on_fail, bool debug_mode, int origin_lazy_lvl,
+                 int target_lazy_lvl, long input_bytes)
       : db_(db),
         compactor_(compactor),
         cf_name_(cf_name),
         input_file_names_(input_file_names),
         output_lvl_(output_lvl),
+        origin_lazy_lvl_(origin_lazy_lvl),
+        target_lazy_lvl_(target_lazy_lvl),
+        input_bytes_(input_bytes),
         compact_options_(compact_options),
         retry_on_fail_(retry_on_fail),
         debug_mode_(debug_mode) {}
   DB* db_;
   FluidLSM* compactor_;
-  const std::string& cf_name_;
+  std::string cf_name_;
   std::vector<std::string> input_file_names_;
   int output_lvl_;
+  // lazy levels reserved by this compaction
+  int origin_lazy_lvl_;
+  int target_lazy_lvl_;
+  long input_bytes_;
+  // groups of files from one RocksDB level that only need a metadata move,
+  // run before the rewrite of input_file_names_
+  std::vector<std::vector<std::string>> trivial_moves_;
+  std::vector<long> trivial_move_bytes_;
   CompactionOptions compact_options_;
   bool retry_on_fail_;
   bool debug_mode_;
@@ -44,6 +66,8 @@ struct CompactionTask {
 struct Run {
   Run(int RocksDB_level) : files_(), RocksDB_level_(RocksDB_level) {}
   void AddFile(SstFileMetaData file);
+  // returns the number of files removed
+  size_t RemoveFiles(const std::set<std::string>& names);
   std::vector<SstFileMetaData> files_;
   std::set<std::string> file_names_;
   int RocksDB_level_;
@@ -63,6 +87,69 @@ struct LazyLevel {
   std::vector<Run> runs;
 };
 
+/**
+ * Records the smallest and largest user key of every SST into its user
+ * collected properties, so FluidLSM can place files created by a flush or a
+ * compaction without reading the full column family metadata.
+ */
+class KeyRangeCollector : public TablePropertiesCollector {
+ public:
+  static const char* kSmallestKey;
+  static const char* kLargestKey;
+
+  Status AddUserKey(const Slice& key, const Slice& value, EntryType type,
+                    SequenceNumber seq, uint64_t file_size) override;
+  Status Finish(UserCollectedProperties* properties) override;
+  UserCollectedProperties GetReadableProperties() const override {
+    return UserCollectedProperties();
+  }
+  const char* Name() const override { return "KeyRangeCollector"; }
+
+ private:
+  bool empty_ = true;
+  std::string smallest_;
+  std::string largest_;
+};
+
+class KeyRangeCollectorFactory : public TablePropertiesCollectorFactory {
+ public:
+  TablePropertiesCollector* CreateTablePropertiesCollector(
+      TablePropertiesCollectorFactory::Context /*context*/) override {
+    return new KeyRangeCollector();
+  }
+  const char* Name() const override { return "KeyRangeCollectorFactory"; }
+};
+
+/**
+ * A lazy level waiting for a compaction slot. Levels that are further
+ * over their run limit are served first, ties go to the smaller level
+ * as it is the one blocking flushes.
+ */
+struct PendingCompaction {
+  int overshoot;  // live runs above the level's run limit
+  int lvl;
+  bool operator<(const PendingCompaction& other) const {
+    if (overshoot != other.overshoot) {
+      return overshoot < other.overshoot;
+    }
+    return lvl > other.lvl;
+  }
+};
+
+/**
+ * State of a partial compaction round of one lazy level. A round moves the
+ * level into a single output RocksDB level (slot) as a stream of key-range
+ * slices, each slice taking every file of the level that overlaps it so
+ * all versions of a key move together.
+ */
+struct PartialRound {
+  bool active = false;
+  int target_lvl = -1;
+  int output_lvl = -1;  // RocksDB level every slice of the round goes to
+  bool has_cursor = false;
+  std::string cursor;  // largest key compacted so far in this round
+};
+
 /**
  * Formation of Fluid LSM-tree is achieved by storing T sorted
  * runs of a level into multiple levels. For example: with size
@@ -88,7 +175,7 @@ class FluidLSM : public EventListener {
  public:
   FluidLSM(int size_ratio, int smaller_lvl_runs_count /* K */,
            int larger_lvl_runs_count /* Z */, long file_size,
-           const Options options);
+           const Options options, int parallel_compactions = 1);
 
   /**
    * Build structure of FluidLSM out of RocksDB levels.
@@ -96,12 +183,61 @@ class FluidLSM : public EventListener {
    */
   void BuildStructure(DB* db);
 
-  int GetSizeRatio() { return size_ratio_; }
-  int GetSmallerLevelRunsCount() { return smaller_lvl_runs_count_; }
-  int GetLargerLevelRunsCount() { return larger_lvl_runs_count_; }
+  /**
+   * The current shape, which PickCompaction may change under
+   * lazy_levels_mutex_ when it adopts a pending tuning
+   */
+  int GetSizeRatio() {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    return size_ratio_;
+  }
+  int GetSmallerLevelRunsCount() {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    return smaller_lvl_runs_count_;
+  }
+  int GetLargerLevelRunsCount() {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    return larger_lvl_runs_count_;
+  }
   int GetLargestOccupiedLevel() const;
   void SetDebugMode(bool mode) { debug_mode_ = mode; }
 
+  /**
+   * Compact a lazy level as a stream of key-range slices of about
+   * `max_bytes` each instead of all at once; 0 turns it off
+   */
+  void SetPartialCompactions(long max_bytes) {
+    partial_compaction_bytes_ = max_bytes;
+  }
+
+  /**
+   * Foreground op latency split by whether a compaction was running.
+   * Called from the replay thread only.
+   */
+  inline void RecordForegroundLatency(uint64_t latency_ns,
+                                      uint64_t count = 1) {
+    if (parallel_compactions_running_.load(std::memory_order_relaxed) > 0) {
+      foreground_during_compaction_.Add(latency_ns, count);
+    } else {
+      foreground_idle_.Add(latency_ns, count);
+    }
+  }
+
+  /**
+   * Compaction sizes and durations next to the foreground latency
+   */
+  std::string CompactionReport();
+
+  long GetTrivialMoves() const { return trivial_moves_; }
+  long GetTrivialMoveBytes() const { return trivial_move_bytes_; }
+
+  /**
+   * Adopts a new (T, K, Z) at the next compaction cycle with no compaction
+   * in flight; the view is then rebuilt with the new level mapping
+   */
+  void SetPendingTuning(int size_ratio, int smaller_lvl_runs_count,
+                        int larger_lvl_runs_count);
+
   /**
    * Prints current state of FluidLSM
    */
@@ -112,6 +248,32 @@ class FluidLSM : public EventListener {
    */
   void OnFlushCompleted(DB* db, const FlushJobInfo& info) override;
 
+  /**
+   * Applies the files added and deleted by a compaction to the view
+   */
+  void OnCompactionCompleted(DB* db, const CompactionJobInfo& ci) override;
+
+  long GetConsistencyMismatches() const { return consistency_mismatches_; }
+
+  /**
+   * Compacts the lazy level holding `RocksDB_lvl` at least one lazy level
+   * down at the next dispatch, even if it is within its run limit. Used to
+   * push old tombstones towards the last level.
+   */
+  void RequestCompaction(DB* db, int RocksDB_lvl);
+
+  /**
+   * True while a compaction runs or waits for a slot
+   */
+  bool HasPendingWork();
+
+  /**
+   * Called after every compaction, once the next ones are scheduled
+   */
+  void SetIdleCallback(std::function<void()> callback) {
+    idle_callback_ = callback;
+  }
+
   static void CompactFiles(void* args);
 
  protected:
@@ -129,20 +291,88 @@ class FluidLSM : public EventListener {
    * Creates new run at `lvl` in FluidLSM using `file_names`
    * the files comes from RocksDB_lvl and mapped to lvl in FluidLSM
    */
-  void CreateRun(DB* db, std::vector<SstFileMetaData> const& file_names,
-                 int lvl, int RocksDB_lvl);
+  void CreateRun(std::vector<SstFileMetaData> const& file_names, int lvl,
+                 int RocksDB_lvl);
+
+  /**
+   * Incremental maintenance of the view, all require lazy_levels_mutex_.
+   * They return false when the view does not match the delta, in which
+   * case the next pick rebuilds it.
+   */
+  Run* GetRunOfRocksDBLevel(int RocksDB_lvl);
+  bool AddFileToView(SstFileMetaData file, int RocksDB_lvl);
+  bool RemoveFilesFromView(const std::set<std::string>& names,
+                           int RocksDB_lvl);
+  void MoveFilesInView(std::vector<std::string> const& file_names,
+                       int RocksDB_lvl);
+  void NormalizeLevelZero();
+  SstFileMetaData MakeFileMetaData(const std::string& path,
+                                   const TableProperties* props) const;
+  static std::string FileName(const std::string& path);
+  void VerifyStructureLocked(DB* db);
+  void ReleaseFiles(std::vector<std::string> const& file_names);
   void ScheduleCompaction(DB* db, const std::string& cf_name, int origin_lvl,
-                          int target_lvl,
+                          int target_lvl, int RocksDB_lvl,
                           std::vector<SstFileMetaData*> input_files);
 
+  /**
+   * Takes the inputs that overlap no other input and no file left in the
+   * output level out of `input_files`. They are grouped by RocksDB level in
+   * batches of up to MAX_MULTI_TRIVIAL_MOVE files that are moved without a
+   * rewrite. Inputs already in the output level are dropped.
+   */
+  void SplitTrivialMoves(int origin_lvl, int RocksDB_lvl,
+                         std::vector<SstFileMetaData*>& input_files,
+                         std::vector<std::vector<SstFileMetaData*>>& moves);
+
+  /**
+   * RocksDB level a compaction from `origin_lvl` to `target_lvl` writes to
+   */
+  int GetTargetSlot(int origin_lvl, int target_lvl);
+
+  /**
+   * Picks the next slice of the round of `lvl`: the first file past the
+   * cursor, grown file by file up to `partial_compaction_bytes_`, plus the
+   * files of the output level it overlaps. Returns false when the round has
+   * nothing left or the slice overlaps a compacting file.
+   */
+  bool PickPartialSlice(int lvl, PartialRound& round,
+                        std::vector<SstFileMetaData*>& input_files,
+                        std::string* largest_key);
+
+  /**
+   * Start queued compactions while slots are free, skipping levels
+   * that overlap a running compaction. Requires lazy_levels_mutex_.
+   */
+  void DispatchCompactions(DB* db, const std::string& cf_name);
+  int GetRunLimit(int lvl, int largest_lvl) const;
+  void BuildStructureLocked(DB* db);
+  void BuildStructureFromMetadata(const ColumnFamilyMetaData& cf_meta);
+
+  /**
+   * Seams for LSMSimulator, which drives the same picking code without a
+   * DB: where the view is rebuilt from, and how a scheduled task is run
+   * (on the LOW pool, requires lazy_levels_mutex_).
+   */
+  virtual void GetMetadata(DB* db, ColumnFamilyMetaData* cf_meta);
+  virtual void RunCompaction(CompactionTask* task);
+
+  /**
+   * Counts a finished task, applies its trivial moves to the view and
+   * releases its levels and files. Requires lazy_levels_mutex_.
+   */
+  void FinishCompactionLocked(CompactionTask* task, bool ok, uint64_t duration,
+                              std::vector<size_t> const& moved_groups,
+                              std::vector<size_t> const& rewritten_groups);
+
   /**
    * Computes the target level for compaction
    */
   int GetCompactionTargetLevel(
       int origin_lvl, std::vector<SstFileMetaData*> const& input_files) const;
 
+  // guards the lazy level view as well as the compaction scheduler state
   std::mutex lazy_levels_mutex_;
-  std::mutex parallel_compactions_mutex_;
   std::vector<LazyLevel> lazy_levels_;
   int size_ratio_;              // T
   int smaller_lvl_runs_count_;  // K
@@ -151,7 +381,40 @@ class FluidLSM : public EventListener {
   Options options_;
   CompactionOptions compact_options_;
   int parallel_compactions_allowed_;
-  int parallel_compactions_running_;
+  std::atomic<int> parallel_compactions_running_;
+  std::priority_queue<PendingCompaction> pending_compactions_;
+  std::set<int> busy_levels_;  // lazy levels read or written right now
+  std::set<std::string> compacting_files_;  // inputs of scheduled compactions
+  std::set<int> requested_levels_;  // see RequestCompaction
+
+  // picks between two rebuilds of the view from the full metadata
+  static const int kConsistencyCheckInterval = 64;
+  bool view_valid_ = false;
+  int picks_since_check_ = 0;
+  long consistency_mismatches_ = 0;
+
+  long partial_compaction_bytes_ = 0;
+  std::vector<PartialRound> partial_rounds_;
+
+  // compaction input bytes and durations, guarded by lazy_levels_mutex_
+  LatencyHistogram compaction_bytes_;
+  LatencyHistogram compaction_durations_;
+  long trivial_moves_ = 0;  // files moved to another level without rewrite
+  long trivial_move_bytes_ = 0;
+  // move batches RocksDB rewrote instead of moving
+  long rewritten_moves_ = 0;
+  long rewritten_move_bytes_ = 0;
+  // replay thread only
+  LatencyHistogram foreground_during_compaction_;
+  LatencyHistogram foreground_idle_;
+
+  bool has_pending_tuning_ = false;
+  int pending_size_ratio_;
+  int pending_smaller_lvl_runs_count_;
+  int pending_larger_lvl_runs_count_;
   bool debug_mode_;
+  std::function<void()> idle_callback_;
 };
-}  // namespace ROCKSDB_NAMESPACE
\ No newline at end of file
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // FLUID_LSM_H_
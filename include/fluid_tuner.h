@@ -0,0 +1,101 @@
+#ifndef FLUID_TUNER_H_
+#define FLUID_TUNER_H_
+
+#include <array>
+#include <memory>
+#include <string>
+
+#include <rocksdb/db.h>
+
+#include "buffer.h"
+#include "db_env.h"
+#include "memtable_switch_controller.h"
+
+using namespace rocksdb;
+
+namespace ROCKSDB_NAMESPACE {
+class FluidLSM;
+}
+
+/**
+ * Shape of a FluidLSM tree: size ratio T, runs K at every level but the
+ * largest and runs Z at the largest level
+ */
+struct FluidSetting {
+  int size_ratio;
+  int smaller_lvl_runs_count;
+  int larger_lvl_runs_count;
+};
+
+/**
+ * Picks (T, K, Z) for FluidLSM with the Dostoevsky cost model, in I/Os per
+ * op for N entries of E bytes, B entries per page, a write buffer of M
+ * bytes, L = ceil(log_T(N * E / M)) levels and a Bloom filter FPR of p
+ * per run:
+ *
+ *   write  = ((T - 1) / (K + 1) * (L - 1) + (T - 1) / (Z + 1)) / B
+ *   lookup = 1 + p * (K * (L - 1) + Z)
+ *   scan   = K * (L - 1) + Z + s * N / B * (Z + 1 / T)
+ *
+ * weighted by the op mix. The mix comes either from a scan of workload.txt
+ * before the run, or from the ops the replay thread reports through
+ * `RecordOp`, in which case the tuner periodically hands a better setting
+ * to FluidLSM which adopts it at its next compaction cycle. Online, the mix
+ * halves every `interval` ops so that it follows phase changes.
+ */
+class FluidTuner {
+public:
+  FluidTuner(std::unique_ptr<DBEnv> &env, std::shared_ptr<Buffer> &buffer);
+
+  /**
+   * Counts the ops of a workload file, returns false if it can't be read
+   */
+  bool ScanWorkload(const std::string &path);
+
+  inline void RecordOp(OpType op) {
+    op_counts_[static_cast<uint8_t>(op)]++;
+    ops_since_tune_++;
+  }
+
+  double EstimateCost(const FluidSetting &setting, double num_entries) const;
+  FluidSetting Recommend(double num_entries) const;
+
+  /**
+   * Logs the best setting for the op mix seen so far next to `current`
+   */
+  void PrintRecommendation(const FluidSetting &current, double num_entries);
+
+  /**
+   * Every `interval` ops folds the interval's ops into the decayed mix,
+   * re-evaluates the model on it and hands a better setting to `tree`
+   */
+  void MaybeRetune(DB *db, FluidLSM *tree);
+
+private:
+  // largest size ratio the search considers
+  static const int kMaxSizeRatio = 16;
+  // a new setting must be this much cheaper than the current one
+  static constexpr double kMinGain = 0.1;
+  // weight of the mix so far when an interval is folded in
+  static constexpr double kMixDecay = 0.5;
+
+  bool Fits(const FluidSetting &setting, double num_entries) const;
+  int NumLevels(int size_ratio, double num_entries) const;
+
+  std::shared_ptr<Buffer> buffer_;
+  double entry_size_;
+  double entries_per_page_;
+  double buffer_size_;
+  double bits_per_key_;
+  double scan_selectivity_;
+  int num_levels_;
+  long interval_;
+  // ops since the last retune
+  std::array<uint64_t, (size_t)OpType::kNumOpTypes> op_counts_{};
+  // op mix the model is weighted by
+  std::array<double, (size_t)OpType::kNumOpTypes> mix_{};
+  uint64_t inserts_scanned_ = 0;
+  long ops_since_tune_ = 0;
+};
+
+#endif // FLUID_TUNER_H_
@@ -0,0 +1,69 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Log-linear histogram of latencies (or any non-negative integer samples).
+ * Every power of two is split in 32 linear sub-buckets, which keeps the
+ * relative error of a percentile under ~3% at a fixed 15 KB footprint.
+ *
+ * Not thread-safe; every recording thread owns its histogram and they are
+ * combined with `Merge`.
+ */
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  inline void Add(uint64_t value, uint64_t count = 1) {
+    buckets_[BucketFor(value)] += count;
+    count_ += count;
+    sum_ += value * count;
+    if (value > max_)
+      max_ = value;
+    if (value < min_)
+      min_ = value;
+  }
+
+  void Merge(const LatencyHistogram &other);
+  void Reset();
+
+  uint64_t Count() const { return count_; }
+  uint64_t Sum() const { return sum_; }
+  uint64_t Max() const { return count_ == 0 ? 0 : max_; }
+  uint64_t Min() const { return count_ == 0 ? 0 : min_; }
+  double Mean() const { return count_ == 0 ? 0 : (double)sum_ / count_; }
+
+  // p in [0, 100]
+  uint64_t Percentile(double p) const;
+
+  // samples in the bucket of `value` and above
+  uint64_t CountAtLeast(uint64_t value) const;
+
+  // "count=.. avg=.. p50=.. p99=.. p99.9=.. max=.."
+  std::string ToString() const;
+
+private:
+  static const int kSubBucketBits = 5;
+  static const uint64_t kSubBuckets = 1ULL << kSubBucketBits;
+  static const size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  static inline size_t BucketFor(uint64_t value) {
+    if (value < kSubBuckets)
+      return value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+  }
+  static uint64_t BucketUpperBound(size_t bucket);
+
+  std::vector<uint64_t> buckets_;
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+  uint64_t min_;
+};
+
+#endif // LATENCY_HISTOGRAM_H_
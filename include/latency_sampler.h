@@ -0,0 +1,55 @@
+#ifndef LATENCY_SAMPLER_H_
+#define LATENCY_SAMPLER_H_
+
+#include <cmath>
+#include <cstdint>
+
+/**
+ * Picks a random 1 in `rate` ops to time. The gap to the next timed op is
+ * drawn from a geometric distribution, so every op is timed with
+ * probability 1/rate while the hot path is a single decrement. A timed op
+ * stands for `Weight()` ops in histograms and totals.
+ *
+ * One sampler per replay thread; not thread-safe.
+ */
+class LatencySampler {
+public:
+  explicit LatencySampler(long rate, uint64_t seed = 0x9E3779B97F4A7C15ULL)
+      : rate_(rate < 1 ? 1 : rate), state_(seed | 1) {
+    countdown_ = Gap();
+  }
+
+  inline bool Next() {
+    if (rate_ == 1) {
+      return true;
+    }
+    if (--countdown_ > 0) {
+      return false;
+    }
+    countdown_ = Gap();
+    return true;
+  }
+
+  long Rate() const { return rate_; }
+  uint64_t Weight() const { return rate_; }
+
+private:
+  uint64_t Gap() {
+    if (rate_ == 1) {
+      return 1;
+    }
+    // xorshift64*, uniform in (0, 1]
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    double u = ((state_ * 0x2545F4914F6CDD1DULL) >> 11) * 0x1.0p-53;
+    u = u > 0 ? u : 0x1.0p-53;
+    return 1 + (uint64_t)(std::log(u) / std::log1p(-1.0 / rate_));
+  }
+
+  long rate_;
+  uint64_t state_;
+  uint64_t countdown_;
+};
+
+#endif // LATENCY_SAMPLER_H_
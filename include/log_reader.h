@@ -0,0 +1,51 @@
+#ifndef LOG_READER_H_
+#define LOG_READER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Reads a log written by `Buffer` line by line, whether it is plain text or
+ * a zstd stream (told apart by the zstd magic number, not the file name).
+ */
+class LogReader {
+ public:
+  LogReader() = default;
+  ~LogReader();
+  LogReader(const LogReader &) = delete;
+  LogReader &operator=(const LogReader &) = delete;
+
+  bool Open(const std::string &path);
+
+  /**
+   * Next line without its newline, false at the end of the log
+   */
+  bool ReadLine(std::string *line);
+
+  /**
+   * Next chunk of decoded bytes, 0 at the end of the log
+   */
+  size_t Read(char *out, size_t len);
+
+  bool IsCompressed() const { return dctx_ != nullptr; }
+
+ private:
+  bool Fill();
+
+  FILE *file_ = nullptr;
+  // zstd decompression state, nullptr for plain text
+  void *dctx_ = nullptr;
+  std::vector<char> in_;
+  size_t in_pos_ = 0;
+  size_t in_size_ = 0;
+  // decoded bytes not handed out yet
+  std::vector<char> out_;
+  size_t out_pos_ = 0;
+  size_t out_size_ = 0;
+  bool eof_ = false;
+  // zstd filled the last output buffer and may hold more decoded bytes
+  bool zstd_pending_ = false;
+};
+
+#endif // LOG_READER_H_
@@ -0,0 +1,90 @@
+#ifndef LSM_SIMULATOR_H_
+#define LSM_SIMULATOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <rocksdb/metadata.h>
+
+#include "buffer.h"
+#include "db_env.h"
+
+using namespace rocksdb;
+
+class SimulatedFluidLSM;
+
+/**
+ * Metadata-only model of the LSM tree: files are key ranges with a size
+ * and an entry count, flushes and compactions only move metadata. Leveled
+ * runs follow RocksDB's picking rules (L0 file trigger, level scores,
+ * kMinOverlappingRatio or kRoundRobin file choice); FluidLSM runs through
+ * FluidLSM's own lazy level view and picking logic.
+ *
+ * Keys are uniformly random (or sequential) 64-bit points; a compaction
+ * keeps the expected number of distinct keys of its inputs, and all of the
+ * obsolete ones when nothing older lies below its output.
+ */
+class LSMSimulator {
+public:
+  explicit LSMSimulator(std::unique_ptr<DBEnv> &env);
+  ~LSMSimulator();
+
+  /**
+   * Ingests `bytes` of user data one write buffer at a time
+   */
+  void Ingest(uint64_t bytes);
+
+  void Report(std::shared_ptr<Buffer> &buffer);
+
+private:
+  SstFileMetaData NewFile(uint64_t smallest, uint64_t largest,
+                          uint64_t entries);
+  std::vector<SstFileMetaData>
+  Merge(std::vector<SstFileMetaData> const &inputs, bool bottommost);
+
+  void Flush(uint64_t entries);
+  void CompactLeveled();
+  bool PickLeveled(int *level, std::vector<size_t> *inputs);
+  void CompactFluid();
+
+  uint64_t LevelTargetBytes(int level) const;
+  uint64_t TreeBytes() const;
+  int NumSortedRuns() const;
+
+  bool fluid_;
+  bool sequential_;
+  bool round_robin_;
+  int num_levels_;
+  int level0_trigger_;
+  double size_ratio_;
+  double entry_size_;
+  double bits_per_key_;
+  double update_fraction_;
+  uint64_t buffer_entries_;
+  uint64_t file_size_;
+  uint64_t max_bytes_for_level_base_;
+
+  // leveled: files of every RocksDB level, L0 newest first, others by key
+  std::vector<std::vector<SstFileMetaData>> levels_;
+  std::vector<uint64_t> round_robin_cursor_;
+  std::unique_ptr<SimulatedFluidLSM> fluid_tree_;
+
+  uint64_t next_file_number_ = 1;
+  uint64_t next_sequential_key_ = 0;
+  uint64_t sequential_key_step_ = 1;
+  double live_keys_ = 0;
+  uint64_t ingested_bytes_ = 0;
+  uint64_t flushed_bytes_ = 0;
+  uint64_t compaction_read_bytes_ = 0;
+  uint64_t compaction_write_bytes_ = 0;
+  uint64_t num_flushes_ = 0;
+  uint64_t num_compactions_ = 0;
+};
+
+/**
+ * Runs the simulator for `simulate_bytes` and writes simulation.log
+ */
+int runSimulation(std::unique_ptr<DBEnv> &env);
+
+#endif // LSM_SIMULATOR_H_
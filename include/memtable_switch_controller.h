@@ -0,0 +1,181 @@
+#ifndef MEMTABLE_SWITCH_CONTROLLER_H_
+#define MEMTABLE_SWITCH_CONTROLLER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <rocksdb/db.h>
+#include <rocksdb/listener.h>
+
+#include "buffer.h"
+#include "db_env.h"
+#include "sample_workload.h"
+#include "switch_cost_tracker.h"
+
+using namespace rocksdb;
+
+/**
+ * Operation classes of workload.txt, indexed in the order
+ * I (insert), U (update), D (point delete), Q (point query), S (range scan)
+ */
+enum class OpType : uint8_t {
+  kInsert = 0,
+  kUpdate,
+  kDelete,
+  kPointQuery,
+  kRangeQuery,
+  kNumOpTypes
+};
+
+inline OpType OpTypeFromCode(char operation) {
+  switch (operation) {
+  case 'I':
+    return OpType::kInsert;
+  case 'U':
+    return OpType::kUpdate;
+  case 'D':
+    return OpType::kDelete;
+  case 'Q':
+    return OpType::kPointQuery;
+  default:
+    return OpType::kRangeQuery;
+  }
+}
+
+/**
+ * Per-op cost model of the memtable representations measured by the
+ * sampled benchmark (see `runSampleWorkload`). The stat file holds one
+ * PerformanceMatrix per representation in the order SkipList, Vector,
+ * HashSkipList.
+ *
+ * Representations follow the numbering of DBEnv::memtable_factory.
+ */
+struct MemtableCostModel {
+  PerformanceMatrix skiplist;
+  PerformanceMatrix vector;
+  PerformanceMatrix hash_skiplist;
+
+  bool Load(const std::string &path);
+
+  /**
+   * Expected foreground cost (ns per op) of running the given op mix on
+   * `rep`. Writes pay the insert cost plus their share of the flush (and,
+   * for Vector, the sort at flush); memtable hits on a mutable Vector pay a
+   * full sort per lookup. SST costs are common to every representation and
+   * are left out as they do not change which one is cheapest.
+   */
+  double EstimateCost(uint16_t rep, double write_fraction,
+                      double read_fraction, double scan_fraction,
+                      double vector_capacity) const;
+};
+
+/**
+ * Decides the memtable representation of the next memtable from the op mix
+ * observed in a sliding window of the last `adaptive_window_size` ops.
+ *
+ * The replay thread reports every op through `RecordOp` and calls
+ * `MaybeSwitch` afterwards. Once the active memtable is about to be sealed
+ * the controller compares the estimated cost of every representation for
+ * the current mix and, if the best one beats the current one by at least
+ * `adaptive_min_gain`, installs it through SetOptions so that the memtable
+ * created at the next switch uses it.
+ *
+ * Seal events arrive through the EventListener interface and only bump a
+ * counter; all bookkeeping stays on the replay thread.
+ */
+class MemtableSwitchController : public EventListener {
+public:
+  MemtableSwitchController(std::unique_ptr<DBEnv> &env,
+                           std::shared_ptr<Buffer> &buffer);
+
+  bool LoadCostModel(const std::string &path);
+
+  // account the cost of every switch (see SwitchCostTracker)
+  void SetCostTracker(std::shared_ptr<SwitchCostTracker> tracker) {
+    cost_tracker_ = tracker;
+  }
+
+  inline void RecordOp(OpType op, uint64_t latency_ns) {
+    uint8_t slot = static_cast<uint8_t>(op);
+    if (window_filled_ == window_.size()) {
+      window_counts_[window_[window_pos_]]--;
+    } else {
+      window_filled_++;
+    }
+    window_[window_pos_] = slot;
+    window_counts_[slot]++;
+    window_pos_ = (window_pos_ + 1) % window_.size();
+
+    lifetime_ops_++;
+    lifetime_latency_ns_ += latency_ns;
+  }
+
+  void MaybeSwitch(DB *db);
+
+  void OnMemTableSealed(const MemTableInfo &info) override;
+
+  void PrintSummary();
+
+  static const char *RepName(uint16_t rep);
+
+  // rep of the active memtable
+  uint16_t CurrentRep() const { return current_rep_; }
+
+private:
+  struct SwitchDecision {
+    int id;
+    uint16_t from;
+    uint16_t to;
+    double estimated_gain;
+    bool active;             // the memtable using `to` has been created
+    double baseline_latency; // avg op latency of the last memtable on `from`
+  };
+
+  void CloseMemtableLifetime();
+  void Decide(DB *db);
+  bool ApplyRep(DB *db, uint16_t rep);
+
+  // number of ops between two ShouldMemTableFlushNow checks
+  static const int kBoundaryCheckInterval = 64;
+
+  std::shared_ptr<Buffer> buffer_;
+  std::shared_ptr<SwitchCostTracker> cost_tracker_;
+  MemtableCostModel model_;
+  std::vector<uint16_t> candidates_;
+  size_t bucket_count_;
+  uint32_t prefix_length_;
+  int32_t skiplist_height_;
+  int32_t skiplist_branching_factor_;
+  double min_gain_;
+  double vector_capacity_; // entries a full Vector memtable holds
+  size_t boundary_reserve_;
+
+  // sliding window of op classes
+  std::vector<uint8_t> window_;
+  size_t window_pos_ = 0;
+  size_t window_filled_ = 0;
+  uint64_t window_counts_[static_cast<int>(OpType::kNumOpTypes)] = {0};
+
+  // representation of the active memtable and of the next one
+  // read by listeners on the sealing thread
+  std::atomic<uint16_t> current_rep_;
+  uint16_t next_rep_;
+  bool decided_ = false;
+  bool disabled_ = false;  // the DB refused a switch, stay on current_rep_
+  int ops_since_check_ = 0;
+
+  std::atomic<uint64_t> sealed_count_{0};
+  uint64_t sealed_seen_ = 0;
+
+  // foreground latency of the active memtable's lifetime
+  uint64_t lifetime_ops_ = 0;
+  uint64_t lifetime_latency_ns_ = 0;
+
+  std::vector<SwitchDecision> pending_; // switches awaiting realized gain
+  int num_switches_ = 0;
+  int num_decisions_ = 0;
+};
+
+#endif // MEMTABLE_SWITCH_CONTROLLER_H_
@@ -0,0 +1,89 @@
+#ifndef MONKEY_FILTER_POLICY_H_
+#define MONKEY_FILTER_POLICY_H_
+
+#include <memory>
+#include <vector>
+
+#include <rocksdb/db.h>
+#include <rocksdb/filter_policy.h>
+
+#include "buffer.h"
+
+using namespace rocksdb;
+
+/**
+ * Level-aware Bloom filter policy in the style of Monkey. A total budget of
+ * filter bits is spread across levels so that the sum of false positive
+ * rates is minimal: the FPR of a level is proportional to the number of
+ * entries it holds, so the small upper levels get more bits per key and
+ * the largest levels fewer.
+ *
+ * Filters are built by a builtin Bloom policy with the bits of the level
+ * the file is created at (flushes at 0, compactions at their output
+ * level). All of them share the builtin format, so one reader serves every
+ * level.
+ */
+class MonkeyFilterPolicy : public FilterPolicy {
+public:
+  /**
+   * `entries_per_level` is the expected number of entries of every
+   * RocksDB level, `fallback_bits_per_key` is used for files created
+   * outside of a level (e.g. ingestion)
+   */
+  MonkeyFilterPolicy(const std::vector<double> &entries_per_level,
+                     double total_bits, double fallback_bits_per_key);
+
+  const char *Name() const override { return "MonkeyFilterPolicy"; }
+  // filters are readable by any builtin Bloom policy
+  const char *CompatibilityName() const override {
+    return reader_policy_->CompatibilityName();
+  }
+  FilterBitsBuilder *
+  GetBuilderWithContext(const FilterBuildingContext &context) const override;
+  FilterBitsReader *GetFilterBitsReader(const Slice &contents) const override {
+    return reader_policy_->GetFilterBitsReader(contents);
+  }
+
+  /**
+   * Minimizes sum(p_i) with p_i = exp(-b_i * ln(2)^2) under
+   * sum(n_i * b_i) = total_bits and b_i >= 0. Levels without entries get
+   * the bits of the deepest level holding data.
+   */
+  static std::vector<double>
+  AllocateBits(const std::vector<double> &entries_per_level,
+               double total_bits);
+
+  /**
+   * Entries each RocksDB level holds once `num_entries` are loaded, filling
+   * levels top-down. `smaller_lvl_runs_count` is K for FluidLSM, where
+   * every RocksDB level is one run of its lazy level, and 0 for leveling.
+   */
+  static std::vector<double>
+  ExpectedEntriesPerLevel(int num_levels, double buffer_entries,
+                          double size_ratio, double num_entries,
+                          int level0_runs, int smaller_lvl_runs_count);
+
+  static double FalsePositiveRate(double bits_per_key);
+
+  const std::vector<double> &GetBitsPerLevel() const { return bits_; }
+
+  /**
+   * Logs the planned bits per key, FPR and filter memory of every level
+   */
+  void PrintAllocation(std::shared_ptr<Buffer> &buffer) const;
+
+  /**
+   * Logs the filter memory and entries of the live files of every level
+   * and, with per-level perf context enabled, the measured FPR
+   */
+  void LogFilterStats(DB *db, std::shared_ptr<Buffer> &buffer) const;
+
+private:
+  std::vector<double> entries_;
+  std::vector<double> bits_;
+  std::vector<std::shared_ptr<const FilterPolicy>> level_policies_;
+  std::shared_ptr<const FilterPolicy> fallback_policy_;
+  std::shared_ptr<const FilterPolicy> reader_policy_;
+};
+
+#endif // MONKEY_FILTER_POLICY_H_
@@ -54,10 +54,74 @@ int parse_arguments(int argc, char *argv[], std::unique_ptr<DBEnv> &env) {
       "kCompactionStyleUniversal, 3 for kCompactionStyleFIFO, 4 for "
       "kCompactionStyleNone; def: 1]",
       {'C', "compaction_style"});
+  args::ValueFlag<int> fluid_lsm_cmd(
+      group1, "fluid_lsm",
+      "[FluidLSM: use Dostoevsky lazy leveling with K and Z runs per level "
+      "instead of RocksDB compactions; def: 0]",
+      {"fluid_lsm"});
+  args::ValueFlag<int> smaller_lvl_runs_count_cmd(
+      group1, "K",
+      "[FluidLSM K: maximum number of runs at every level but the largest; "
+      "def: 1]",
+      {'K', "smaller_lvl_runs"});
+  args::ValueFlag<int> larger_lvl_runs_count_cmd(
+      group1, "Z",
+      "[FluidLSM Z: maximum number of runs at the largest level; def: 1]",
+      {'Z', "larger_lvl_runs"});
+  args::ValueFlag<int> fluid_debug_cmd(
+      group1, "fluid_debug",
+      "[FluidLSM Debug: print the lazy levels and every compaction; def: 0]",
+      {"fluid_debug"});
+  args::ValueFlag<long> partial_compaction_bytes_cmd(
+      group1, "partial_compaction_bytes",
+      "[FluidLSM Partial Compactions: compact a level as a stream of "
+      "key-range slices of about this many bytes; 0 for whole levels; "
+      "def: 0]",
+      {"partial_compaction_bytes"});
+  args::ValueFlag<int> fluid_tune_cmd(
+      group1, "fluid_tune",
+      "[FluidLSM Tuner: 0 for off, 1 for printing the best T, K, Z for "
+      "workload.txt, 2 for applying the best T, K, Z online; def: 0]",
+      {"fluid_tune"});
+  args::ValueFlag<long> fluid_tune_interval_cmd(
+      group1, "fluid_tune_interval",
+      "[FluidLSM Tuner Interval: number of ops between two online tuning "
+      "decisions; def: 100000]",
+      {"fluid_tune_interval"});
+  args::ValueFlag<long> verify_compactions_cmd(
+      group1, "verify_compactions",
+      "[Verify Compactions: after every compaction read back 1 in N written "
+      "keys and check their latest value is visible; 0 for off; def: 0]",
+      {"verify_compactions"});
+  args::ValueFlag<int> parallel_compactions_cmd(
+      group1, "parallel_compactions",
+      "[Parallel Compactions: maximum number of FluidLSM compactions running "
+      "at the same time on disjoint lazy levels; def: 1]",
+      {"parallel_compactions"});
+  args::ValueFlag<long> rate_limit_mb_cmd(
+      group1, "rate_limit_mb",
+      "[Rate Limit: cap on flush and compaction writes in MB/s, 0 for no "
+      "limit; def: 0]",
+      {"rate_limit_mb"});
+  args::ValueFlag<long> rate_limit_p99_us_cmd(
+      group1, "rate_limit_p99_us",
+      "[Rate Limit Target: throttle flush and compaction writes whenever the "
+      "foreground p99 goes over this many us, 0 for off; def: 0]",
+      {"rate_limit_p99_us"});
+  args::ValueFlag<long> rate_limit_window_cmd(
+      group1, "rate_limit_window",
+      "[Rate Limit Window: number of ops between two rate adjustments; "
+      "def: 10000]",
+      {"rate_limit_window"});
   args::ValueFlag<int> bits_per_key_cmd(
       group1, "bits_per_key",
       "The number of bits per key assigned to Bloom filter [def: 10]",
       {'b', "bits_per_key"});
+  args::ValueFlag<int> monkey_filters_cmd(
+      group1, "monkey",
+      "[Monkey: allocate the Bloom filter memory of -b bits per key across "
+      "levels to minimize the sum of false positive rates; def: 0]",
+      {"monkey"});
   args::ValueFlag<int> block_cache_cmd(
       group1, "bb", "Block cache size in MB [def: 8 MB]", {"bb"});
   args::ValueFlag<int> enable_perf_iostat_cmd(
@@ -65,6 +129,52 @@ int parse_arguments(int argc, char *argv[], std::unique_ptr<DBEnv> &env) {
       "Enable RocksDB's internal Perf and IOstat [def: 0]", {"stat"});
   args::ValueFlag<int> show_progress_cmd(
       group1, "show_progress_bar", "Shows progress bar [def: 0]", {"progress"});
+  args::ValueFlag<double> delete_persistence_threshold_cmd(
+      group1, "del_per_th",
+      "Delete persistence threshold in seconds; files whose oldest "
+      "tombstone misses its level's share of it are compacted [def: -1]",
+      {'t', "dpth"});
+  args::ValueFlag<int> track_stalls_cmd(
+      group1, "track_stalls",
+      "[Track Stalls: log every write stall with its cause, duration and "
+      "the ops it overlapped; def: 0]",
+      {"stalls"});
+  args::ValueFlag<long> stats_interval_ms_cmd(
+      group1, "stats_interval_ms",
+      "[Stats Interval: ms between two live stats snapshots in "
+      "stats_live.log, 0 for off; def: 0]",
+      {"stats_interval_ms"});
+  args::ValueFlag<std::string> trace_file_cmd(
+      group1, "trace_file",
+      "[Trace File: Chrome trace/Perfetto timeline of ops, flushes, "
+      "compactions and stalls, empty for off; def: \"\"]",
+      {"trace_file"});
+  args::ValueFlag<long> trace_sample_rate_cmd(
+      group1, "trace_sample_rate",
+      "[Trace Sample Rate: keep 1 in this many foreground ops in the "
+      "timeline; def: 100]",
+      {"trace_sample_rate"});
+  args::ValueFlag<int> mmap_logs_cmd(
+      group1, "mmap_logs",
+      "[Mmap Logs: write the log files through a memory-mapped file so a "
+      "killed run keeps them; 0 merges lines by timestamp but loses the "
+      "queued ones on SIGINT/SIGTERM; def: 1]",
+      {"mmap_logs"});
+  args::ValueFlag<int> compress_logs_cmd(
+      group1, "compress_logs",
+      "[Compress Logs: zstd level of the log files (.zst), read them with "
+      "log_cat; 0 for plain text; def: 0]",
+      {"compress_logs"});
+  args::ValueFlag<long> perf_counters_cmd(
+      group1, "perf_counters",
+      "[Perf Counters: read cycles, instructions, LLC, branch and dTLB "
+      "misses around 1 in N ops; 0 for off; def: 0]",
+      {"perf_counters"});
+  args::ValueFlag<long> latency_sample_rate_cmd(
+      group1, "latency_sample_rate",
+      "[Latency Sample Rate: time and log a random 1 in N ops, histograms "
+      "and totals are scaled by N; def: 1]",
+      {"latency_sample_rate"});
 
   // LSMMemoryProfiling
   args::ValueFlag<long> num_inserts_cmd(
@@ -132,6 +242,40 @@ int parse_arguments(int argc, char *argv[], std::unique_ptr<DBEnv> &env) {
     "def: 20000]",
     {'n', "num_kv_entries"});
 
+  args::ValueFlag<uint64_t> simulate_bytes_cmd(
+      group1, "simulate_bytes",
+      "[Simulate: ingest this many bytes on a metadata-only model of the "
+      "tree (leveled or --fluid_lsm) and report write/space amplification, "
+      "level shapes and lookup cost; 0 for off; def: 0]",
+      {"simulate_bytes"});
+  args::ValueFlag<int> simulate_sequential_cmd(
+      group1, "simulate_sequential",
+      "[Simulate Sequential: simulated keys arrive in order instead of "
+      "uniformly at random; def: 0]",
+      {"simulate_sequential"});
+
+  args::ValueFlag<int> adaptive_memtable_cmd(
+      group1, "adaptive_memtable",
+      "[Adaptive Memtable: switch the memtable representation at memtable "
+      "boundaries based on the observed op mix and sample_workload.stat; "
+      "def: 0]",
+      {"adaptive_memtable"});
+  args::ValueFlag<long> adaptive_window_size_cmd(
+      group1, "adaptive_window",
+      "[Adaptive Window: number of most recent ops forming the op mix; "
+      "def: 10000]",
+      {"adaptive_window"});
+  args::ValueFlag<double> adaptive_min_gain_cmd(
+      group1, "adaptive_min_gain",
+      "[Adaptive Min Gain: minimum estimated relative gain to switch the "
+      "memtable representation; def: 0.1]",
+      {"adaptive_min_gain"});
+  args::ValueFlag<int> switch_cost_cmd(
+      group1, "switch_cost",
+      "[Switch Cost: record duration, bytes copied, peak memory delta and "
+      "write latency of every memtable representation switch; def: 0]",
+      {"switch_cost"});
+
   try {
     parser.ParseCLI(argc, argv);
   } catch (args::Help &) {
@@ -171,14 +315,70 @@ int parse_arguments(int argc, char *argv[], std::unique_ptr<DBEnv> &env) {
       compaction_pri_cmd ? args::get(compaction_pri_cmd) : env->compaction_pri;
   env->compaction_style = compaction_style_cmd ? args::get(compaction_style_cmd)
                                                : env->compaction_style;
+  env->enable_fluid_lsm =
+      fluid_lsm_cmd ? args::get(fluid_lsm_cmd) != 0 : env->enable_fluid_lsm;
+  env->smaller_lvl_runs_count = smaller_lvl_runs_count_cmd
+                                    ? args::get(smaller_lvl_runs_count_cmd)
+                                    : env->smaller_lvl_runs_count;
+  env->larger_lvl_runs_count = larger_lvl_runs_count_cmd
+                                   ? args::get(larger_lvl_runs_count_cmd)
+                                   : env->larger_lvl_runs_count;
+  env->fluid_debug =
+      fluid_debug_cmd ? args::get(fluid_debug_cmd) != 0 : env->fluid_debug;
+  env->partial_compaction_bytes = partial_compaction_bytes_cmd
+                                      ? args::get(partial_compaction_bytes_cmd)
+                                      : env->partial_compaction_bytes;
+  env->fluid_tune = fluid_tune_cmd ? args::get(fluid_tune_cmd) : env->fluid_tune;
+  env->fluid_tune_interval = fluid_tune_interval_cmd
+                                 ? args::get(fluid_tune_interval_cmd)
+                                 : env->fluid_tune_interval;
+  env->verify_compactions = verify_compactions_cmd
+                                ? args::get(verify_compactions_cmd)
+                                : env->verify_compactions;
+  env->max_parallel_compactions = parallel_compactions_cmd
+                                      ? args::get(parallel_compactions_cmd)
+                                      : env->max_parallel_compactions;
+  env->rate_limit_mb =
+      rate_limit_mb_cmd ? args::get(rate_limit_mb_cmd) : env->rate_limit_mb;
+  env->rate_limit_p99_us = rate_limit_p99_us_cmd
+                               ? args::get(rate_limit_p99_us_cmd)
+                               : env->rate_limit_p99_us;
+  env->rate_limit_window = rate_limit_window_cmd
+                               ? args::get(rate_limit_window_cmd)
+                               : env->rate_limit_window;
   env->bits_per_key =
       bits_per_key_cmd ? args::get(bits_per_key_cmd) : env->bits_per_key;
+  env->monkey_filters = monkey_filters_cmd
+                            ? args::get(monkey_filters_cmd) != 0
+                            : env->monkey_filters;
   env->block_cache =
       block_cache_cmd ? args::get(block_cache_cmd) : env->block_cache;
   env->SetPerfIOStat(enable_perf_iostat_cmd ? args::get(enable_perf_iostat_cmd)
                                             : env->IsPerfIOStatEnabled());
   env->SetShowProgress(show_progress_cmd ? args::get(show_progress_cmd)
                                          : env->IsShowProgressEnabled());
+  env->delete_persistence_threshold =
+      delete_persistence_threshold_cmd
+          ? args::get(delete_persistence_threshold_cmd)
+          : env->delete_persistence_threshold;
+  env->track_stalls =
+      track_stalls_cmd ? args::get(track_stalls_cmd) != 0 : env->track_stalls;
+  env->stats_interval_ms = stats_interval_ms_cmd
+                               ? args::get(stats_interval_ms_cmd)
+                               : env->stats_interval_ms;
+  env->trace_file = trace_file_cmd ? args::get(trace_file_cmd) : env->trace_file;
+  env->trace_sample_rate = trace_sample_rate_cmd
+                               ? args::get(trace_sample_rate_cmd)
+                               : env->trace_sample_rate;
+  env->mmap_logs =
+      mmap_logs_cmd ? args::get(mmap_logs_cmd) != 0 : env->mmap_logs;
+  env->compress_logs =
+      compress_logs_cmd ? args::get(compress_logs_cmd) : env->compress_logs;
+  env->perf_counters =
+      perf_counters_cmd ? args::get(perf_counters_cmd) : env->perf_counters;
+  env->latency_sample_rate = latency_sample_rate_cmd
+                                 ? args::get(latency_sample_rate_cmd)
+                                 : env->latency_sample_rate;
 
   // LSM options
   env->num_inserts =
@@ -210,5 +410,56 @@ int parse_arguments(int argc, char *argv[], std::unique_ptr<DBEnv> &env) {
   env->num_kv_entries = num_kv_entries_cmd? args::get(num_kv_entries_cmd): env->num_kv_entries;
   env->range_query_selectivity = range_query_selectivity_cmd? args::get(range_query_selectivity_cmd): env->range_query_selectivity;
 
+  env->simulate_bytes =
+      simulate_bytes_cmd ? args::get(simulate_bytes_cmd) : env->simulate_bytes;
+  env->simulate_sequential = simulate_sequential_cmd
+                                 ? args::get(simulate_sequential_cmd) != 0
+                                 : env->simulate_sequential;
+
+  env->adaptive_memtable = adaptive_memtable_cmd
+                               ? args::get(adaptive_memtable_cmd) != 0
+                               : env->adaptive_memtable;
+  env->adaptive_window_size = adaptive_window_size_cmd
+                                  ? args::get(adaptive_window_size_cmd)
+                                  : env->adaptive_window_size;
+  env->adaptive_min_gain = adaptive_min_gain_cmd
+                               ? args::get(adaptive_min_gain_cmd)
+                               : env->adaptive_min_gain;
+  env->switch_cost_tracking = switch_cost_cmd
+                                  ? args::get(switch_cost_cmd) != 0
+                                  : env->switch_cost_tracking;
+
+  if (env->fluid_tune == 2 && !env->enable_fluid_lsm) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: Online tuning (--fluid_tune=2) needs --fluid_lsm=1"
+              << std::endl;
+    return 1;
+  }
+
+  if (env->enable_fluid_lsm) {
+    int max_runs = (int)env->size_ratio - 1;
+    if (env->smaller_lvl_runs_count < 1 ||
+        env->smaller_lvl_runs_count > max_runs ||
+        env->larger_lvl_runs_count < 1 ||
+        env->larger_lvl_runs_count > max_runs) {
+      std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                << "]: FluidLSM needs 1 <= K, Z <= T - 1 (K: "
+                << env->smaller_lvl_runs_count
+                << ", Z: " << env->larger_lvl_runs_count
+                << ", T: " << env->size_ratio << ")" << std::endl;
+      return 1;
+    }
+    // every lazy level past the first spans K + 1 RocksDB levels, ask for
+    // room for at least two of them
+    int min_levels = 2 + 2 * (env->smaller_lvl_runs_count + 1);
+    if (env->num_levels < min_levels) {
+      std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                << "]: FluidLSM with K = " << env->smaller_lvl_runs_count
+                << " needs at least " << min_levels << " levels, got "
+                << env->num_levels << std::endl;
+      return 1;
+    }
+  }
+
   return 0;
 }
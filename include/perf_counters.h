@@ -0,0 +1,77 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "buffer.h"
+
+/**
+ * Hardware counters (perf_event_open) of the calling thread, read around a
+ * sampled op or a whole benchmark phase and averaged per (label, memtable
+ * rep). Counters the kernel or the CPU refuses are left out; when even the
+ * cycle counter can not be opened, `Open` fails and nothing is recorded.
+ * Background flushes and compactions run on other threads and are not
+ * counted.
+ */
+class PerfCounters {
+ public:
+  enum Counter {
+    kCycles,
+    kInstructions,
+    kLLCMisses,
+    kBranchMisses,
+    kDTLBMisses,
+    kNumCounters
+  };
+
+  PerfCounters() = default;
+  ~PerfCounters();
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool Open();
+  bool IsOpen() const { return leader_ >= 0; }
+
+  void Begin() {
+    begin_valid_ = Read(begin_, &begin_enabled_, &begin_running_);
+  }
+
+  /**
+   * Attributes the counts since `Begin` to `ops` ops of `label` on `rep`
+   */
+  void End(const char *label, const char *rep, uint64_t ops = 1);
+
+  void PrintSummary(std::shared_ptr<Buffer> &buffer);
+  void PrintSummary(std::ostream &out);
+
+  static const char *CounterName(int counter);
+
+ private:
+  struct Aggregate {
+    uint64_t samples = 0;
+    uint64_t ops = 0;
+    uint64_t totals[kNumCounters] = {};
+  };
+
+  bool Read(uint64_t *values, uint64_t *time_enabled, uint64_t *time_running);
+
+  int leader_ = -1;
+  int fds_[kNumCounters] = {-1, -1, -1, -1, -1};
+  // position of every counter in a group read, -1 if it is not open
+  int slot_[kNumCounters] = {-1, -1, -1, -1, -1};
+  int num_open_ = 0;
+
+  uint64_t begin_[kNumCounters] = {};
+  uint64_t begin_enabled_ = 0;
+  uint64_t begin_running_ = 0;
+  bool begin_valid_ = false;
+  // samples where the group was multiplexed off the PMU between Begin and End
+  uint64_t dropped_ = 0;
+  std::map<std::pair<std::string, std::string>, Aggregate> aggregates_;
+};
+
+#endif // PERF_COUNTERS_H_
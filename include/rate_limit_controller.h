@@ -0,0 +1,60 @@
+#ifndef RATE_LIMIT_CONTROLLER_H_
+#define RATE_LIMIT_CONTROLLER_H_
+
+#include <memory>
+
+#include <rocksdb/rate_limiter.h>
+
+#include "buffer.h"
+#include "latency_histogram.h"
+
+using namespace rocksdb;
+
+/**
+ * Auto-tunes the background write budget of a RateLimiter from the
+ * foreground latency seen by the replay loop. Every `window_ops` ops the
+ * p99 of the window is compared with the target: above it the budget is
+ * cut multiplicatively, below it the budget grows back additively (AIMD),
+ * between `max_bytes_per_sec / kMaxCutFactor` and `max_bytes_per_sec`.
+ *
+ * Flushes and compactions (RocksDB's or FluidLSM's CompactFiles) all write
+ * through the same limiter, so both compaction modes are covered.
+ */
+class RateLimitController {
+public:
+  RateLimitController(std::shared_ptr<RateLimiter> limiter,
+                      uint64_t target_p99_ns, int64_t max_bytes_per_sec,
+                      long window_ops, std::shared_ptr<Buffer> &buffer);
+
+  inline void RecordOp(uint64_t latency_ns, uint64_t count = 1) {
+    window_.Add(latency_ns, count);
+    if ((long)window_.Count() >= window_ops_) {
+      Adjust();
+    }
+  }
+
+  void PrintSummary();
+
+private:
+  void Adjust();
+
+  // the budget never drops under max / kMaxCutFactor
+  static const int kMaxCutFactor = 64;
+  static constexpr double kDecrease = 0.7;
+  // fraction of the max budget given back per calm window
+  static constexpr double kIncrease = 0.05;
+
+  std::shared_ptr<RateLimiter> limiter_;
+  std::shared_ptr<Buffer> buffer_;
+  uint64_t target_p99_ns_;
+  int64_t max_bytes_per_sec_;
+  int64_t min_bytes_per_sec_;
+  int64_t bytes_per_sec_;
+  long window_ops_;
+  LatencyHistogram window_;
+  int num_windows_ = 0;
+  int num_adjustments_ = 0;
+  int64_t lowest_bytes_per_sec_;
+};
+
+#endif // RATE_LIMIT_CONTROLLER_H_
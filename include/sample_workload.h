@@ -1,10 +1,69 @@
 #ifndef RUN_SAMPLE_WORKLOAD_H_
 #define RUN_SAMPLE_WORKLOAD_H_
 
+#include <cstdio>
+#include <cstdlib>
+#include <istream>
 #include <memory>
 
 #include "db_env.h"
 
+struct PerformanceMatrix {
+  double insertTime;    // average insert time per unit
+  double sortingTime;   // Only used in vector: average sorting time of a full vector
+  double readTime;      // average Point read time per unit
+  double scanTime;      // average Range scan time per unit
+  double sstFlushTime;  // Only needed by SkipList and HashSkipList: average sst flush time
+  double sstReadTime;   // Only needed by SkipList and HashSkipList: average Point read time per unit in sst files
+  double sstScanTime;   // Only needed by SkipList and HashSkipList: average Range scan time per unit in sst files
+
+  double numEntriesRatioToVec; // ratio of number of entries current data structure can hold when the memtable is full/scheduled
+                               // for flush compared to Vector since Vector has the lowest memory overhead
+
+  static PerformanceMatrix *GetNewPerfMatrix() {
+    PerformanceMatrix *matrix = (PerformanceMatrix *)malloc(sizeof(PerformanceMatrix));
+    matrix->insertTime = 0;
+    matrix->sortingTime = 0;
+    matrix->readTime = 0;
+    matrix->scanTime = 0;
+    matrix->sstFlushTime = 0;
+    matrix->sstReadTime = 0;
+    matrix->sstScanTime = 0;
+    return matrix;
+  }
+
+  void PrintPerfMatrix(const char *type) {
+    printf("Data Structure Type:  %s\n"
+           "InsertTime:           %f\n"
+           "SortingTime:          %f\n"
+           "ReadTime:             %f\n"
+           "ScanTime:             %f\n"
+           "sstFlushTime:         %f\n"
+           "sstReadTime:          %f\n"
+           "sstScanTime:          %f\n"
+           "numEntriesRatioToVec: %f\n", type,
+          insertTime, sortingTime, readTime, scanTime, sstFlushTime, sstReadTime, sstScanTime, numEntriesRatioToVec);
+  }
+
+  void FlushToBuffer(std::shared_ptr<Buffer> buffer) {
+    (*buffer) << insertTime << std::endl
+              << sortingTime << std::endl
+              << readTime << std::endl
+              << scanTime << std::endl
+              << sstFlushTime << std::endl
+              << sstReadTime << std::endl
+              << sstScanTime << std::endl
+              << numEntriesRatioToVec << std::endl;
+  }
+
+  // Reads back one matrix in the order written by FlushToBuffer
+  bool ReadFromStream(std::istream &in) {
+    return static_cast<bool>(in >> insertTime >> sortingTime >> readTime >>
+                             scanTime >> sstFlushTime >> sstReadTime >>
+                             sstScanTime >> numEntriesRatioToVec);
+  }
+};
+
 extern std::string kDBPath;
 extern std::string buffer_file;
 
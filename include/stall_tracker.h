@@ -0,0 +1,94 @@
+#ifndef STALL_TRACKER_H_
+#define STALL_TRACKER_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <rocksdb/db.h>
+#include <rocksdb/listener.h>
+
+#include "buffer.h"
+#include "latency_histogram.h"
+
+using namespace rocksdb;
+
+/**
+ * Records every write stall (delay or stop) with its duration and cause,
+ * and ties the foreground ops that overlap a stall to it. The cause is read
+ * from the DB when the stall starts, in the order RocksDB checks them: too
+ * many memtables, too many L0 files, too many pending compaction bytes.
+ */
+class StallTracker : public EventListener {
+ public:
+  explicit StallTracker(std::shared_ptr<Buffer> &buffer);
+
+  /**
+   * The callback has no DB handle, causes are "unknown" until this is set
+   */
+  void SetDB(DB *db) { db_ = db; }
+
+  void OnStallConditionsChanged(const WriteStallInfo &info) override;
+
+  /**
+   * Called by the replay thread once an op of `latency_ns` finished
+   */
+  inline void RecordOp(uint64_t latency_ns, uint64_t count = 1) {
+    uint64_t end_ns = NowNanos();
+    all_ops_.Add(latency_ns, count);
+    // the op overlaps a stall if one is running or one ended after it began
+    if (stalled_.load(std::memory_order_acquire) ||
+        last_stall_end_ns_.load(std::memory_order_acquire) + latency_ns >
+            end_ns) {
+      RecordStalledOp(latency_ns, count);
+    } else {
+      unstalled_ops_.Add(latency_ns, count);
+    }
+  }
+
+  /**
+   * Logs every stall interval and the latency split, `statistics` (may be
+   * null) adds RocksDB's own stall micros for comparison
+   */
+  void PrintSummary(const std::shared_ptr<Statistics> &statistics);
+
+ private:
+  struct StallInterval {
+    std::string cause;
+    bool stopped;
+    uint64_t start_ns;
+    uint64_t end_ns;  // 0 while the stall lasts
+    long overlapping_ops = 0;
+    uint64_t max_op_latency_ns = 0;
+  };
+
+  static uint64_t NowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  std::string GetStallCause();
+  void RecordStalledOp(uint64_t latency_ns, uint64_t count);
+
+  std::shared_ptr<Buffer> buffer_;
+  std::atomic<DB *> db_{nullptr};
+  uint64_t start_ns_;
+
+  std::atomic<bool> stalled_{false};
+  std::atomic<uint64_t> last_stall_end_ns_{0};
+
+  // guards stalls_
+  std::mutex mutex_;
+  std::vector<StallInterval> stalls_;
+
+  // replay thread only
+  LatencyHistogram all_ops_;
+  LatencyHistogram stalled_ops_;
+  LatencyHistogram unstalled_ops_;
+};
+
+#endif // STALL_TRACKER_H_
@@ -8,7 +8,11 @@
 #define STATS_H_
 
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <mutex>
+#include <string>
 #include <vector> 
 
 using namespace std;
@@ -17,9 +21,12 @@ struct FadeFileInfo{
   std::string file_id;
   int file_level;
   long file_entry_count;
-  long file_tombstone_count;
+  long file_tombstone_count;  // point + range
+  long file_point_tombstone_count;
+  long file_range_tombstone_count;
   long file_size;
-  double file_age;
+  double file_age;  // seconds since the file was created
+  double oldest_tombstone_age;  // seconds, -1 if none or unknown
   bool file_ttl_expired;
 };
 
@@ -31,16 +38,20 @@ private:
 
 public:
   static Stats* getInstance();
-  // operation stats
+  // operation stats, counted by the replay thread
   uint64_t key_size;
   uint64_t value_size;
-  long inserts_completed;
-  long updates_completed;
+  std::atomic<long> inserts_completed;
+  std::atomic<long> updates_completed;
   float update_proportion;
-  long point_deletes_completed;
-  long range_deletes_completed;
-  long point_queries_completed;
-  long range_queries_completed;
+  std::atomic<long> point_deletes_completed;
+  std::atomic<long> range_deletes_completed;
+  std::atomic<long> point_queries_completed;
+  std::atomic<long> range_queries_completed;
+
+  // guards the tree and file stats below, they are refreshed as a whole
+  // by StatsCollector
+  std::mutex tree_mutex;
 
   // current tree stats
   int levels_in_tree;
@@ -52,19 +63,25 @@ public:
   // current file stats
   std::vector<int> files_in_level;
   std::vector<FadeFileInfo> fade_file_info;
-
-  // compaction stats
-  long compaction_count;
-  long compactions_by_pointer_manipulation;
-  long files_read_for_compaction;
-  long bytes_read_for_compaction;
-  long files_written_after_compaction;
-  long bytes_written_after_compaction;
+  uint64_t fade_file_info_micros;  // when the ages above were taken
+
+  // compaction stats, counted by listeners on background threads
+  std::atomic<long> compaction_count;
+  std::atomic<long> compactions_by_pointer_manipulation;
+  std::atomic<long> bytes_saved_by_pointer_manipulation;
+  std::atomic<long> files_read_for_compaction;
+  std::atomic<long> bytes_read_for_compaction;
+  std::atomic<long> files_written_after_compaction;
+  std::atomic<long> bytes_written_after_compaction;
+  std::atomic<long> bytes_flushed;
 
   // consolidated stats
   float space_amp;
   float write_amp;
 
+  // delete persistence threshold in seconds, -1 when FADE is off
+  double delete_persistence_threshold;
+
   // latency stats
   long exp_runtime; // !YBS-sep09-XX!
 
@@ -72,7 +89,9 @@ public:
   bool completion_status;
   bool db_open;
 
-  void printStats();
+  void printStats(std::ostream &out = std::cout);
+  // tombstones per level and every file holding some
+  void printFadeFileInfo(std::ostream &out = std::cout);
 
 
 };
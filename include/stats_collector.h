@@ -0,0 +1,61 @@
+#ifndef STATS_COLLECTOR_H_
+#define STATS_COLLECTOR_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <rocksdb/db.h>
+#include <rocksdb/listener.h>
+
+#include "buffer.h"
+#include "stats.h"
+
+using namespace rocksdb;
+
+/**
+ * Keeps the `Stats` singleton current while a workload runs. Flush and
+ * compaction counters are added as the listener callbacks fire; the tree
+ * shape (levels, files, entries, tombstones) is re-read from RocksDB by
+ * `Refresh`. With an interval, a background thread refreshes and appends a
+ * `printStats` snapshot to `stats_live.log` every `interval_ms`.
+ */
+class StatsCollector : public EventListener {
+ public:
+  explicit StatsCollector(long interval_ms);
+  ~StatsCollector();
+
+  void OnFlushCompleted(DB *db, const FlushJobInfo &fji) override;
+  void OnCompactionCompleted(DB *db, const CompactionJobInfo &ci) override;
+
+  /**
+   * Starts the periodic snapshots, a no-op without an interval
+   */
+  void Start(DB *db);
+
+  /**
+   * Stops the snapshot thread, must be called before the DB is closed
+   */
+  void Stop();
+
+  /**
+   * Fills the tree and file stats of `Stats` from the column family
+   * metadata and the table properties
+   */
+  static void Refresh(DB *db);
+
+ private:
+  void Run(DB *db);
+
+  long interval_ms_;
+  std::unique_ptr<Buffer> buffer_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif // STATS_COLLECTOR_H_
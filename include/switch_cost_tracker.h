@@ -0,0 +1,107 @@
+#ifndef SWITCH_COST_TRACKER_H_
+#define SWITCH_COST_TRACKER_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <rocksdb/db.h>
+#include <rocksdb/listener.h>
+
+#include "buffer.h"
+#include "latency_histogram.h"
+
+using namespace rocksdb;
+
+/**
+ * Accounts the cost of every memtable representation switch issued by the
+ * MemtableSwitchController.
+ *
+ * A switch window opens when the new representation is installed and
+ * closes once the last memtable built on the old representation has been
+ * flushed, i.e. when both forms stop coexisting in memory. For every window
+ * we record
+ *   - the time spent installing the new representation (foreground),
+ *   - the window duration,
+ *   - the user bytes moved out of the old representation by its flush,
+ *   - the peak growth of the memtable memory over the window,
+ *   - the latency distribution of writes that landed inside the window.
+ *
+ * Listener callbacks only stamp timestamps; the event is finalized and
+ * logged from the replay thread on its next `OnForegroundWrite`.
+ */
+class SwitchCostTracker : public EventListener {
+public:
+  explicit SwitchCostTracker(std::shared_ptr<Buffer> &buffer)
+      : buffer_(buffer) {}
+
+  // replay thread, around the SetOptions call that installs `to`
+  void BeginSwitch(DB *db, const char *from, const char *to);
+  void EndApply();
+  void CancelSwitch();
+
+  // replay thread, after every write op; `count` is 0 for untimed ops
+  inline void OnForegroundWrite(DB *db, uint64_t latency_ns,
+                                uint64_t count = 1) {
+    if (!window_open_)
+      return;
+    if (count > 0)
+      window_latency_.Add(latency_ns, count);
+    if (++ops_since_sample_ >= kMemorySampleInterval) {
+      ops_since_sample_ = 0;
+      SampleMemory(db);
+    }
+    if (window_closed_.load(std::memory_order_acquire)) {
+      FinishSwitch(db);
+    }
+  }
+
+  void OnMemTableSealed(const MemTableInfo &info) override;
+  void OnFlushBegin(DB *db, const FlushJobInfo &fji) override;
+  void OnFlushCompleted(DB *db, const FlushJobInfo &fji) override;
+
+  // closes a window still open at the end of the run
+  void PrintSummary(DB *db);
+
+private:
+  enum class Phase { kIdle, kInstalled, kActivated, kFlushing };
+
+  void SampleMemory(DB *db);
+  void FinishSwitch(DB *db);
+
+  // number of writes between two memtable memory samples
+  static const int kMemorySampleInterval = 256;
+
+  std::shared_ptr<Buffer> buffer_;
+
+  // replay thread state of the open window
+  bool window_open_ = false;
+  int ops_since_sample_ = 0;
+  int num_switches_ = 0;
+  const char *from_ = nullptr;
+  const char *to_ = nullptr;
+  std::chrono::steady_clock::time_point begin_;
+  uint64_t apply_ns_ = 0;
+  uint64_t baseline_mem_ = 0;
+  uint64_t peak_mem_ = 0;
+  LatencyHistogram window_latency_;
+
+  // written by listener callbacks
+  std::mutex mutex_;
+  Phase phase_ = Phase::kIdle;
+  int flush_job_id_ = -1;
+  std::chrono::steady_clock::time_point end_;
+  uint64_t bytes_copied_ = 0;
+  std::atomic<bool> window_closed_{false};
+
+  // totals over all switches
+  uint64_t total_apply_ns_ = 0;
+  uint64_t total_window_ns_ = 0;
+  uint64_t total_bytes_copied_ = 0;
+  uint64_t max_peak_mem_delta_ = 0;
+  LatencyHistogram all_windows_latency_;
+};
+
+#endif // SWITCH_COST_TRACKER_H_
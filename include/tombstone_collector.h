@@ -0,0 +1,83 @@
+#ifndef TOMBSTONE_COLLECTOR_H_
+#define TOMBSTONE_COLLECTOR_H_
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <rocksdb/db.h>
+#include <rocksdb/table_properties.h>
+
+using namespace rocksdb;
+
+/**
+ * Maps sequence numbers to the wall-clock time they were written at, so
+ * tombstones can be aged from their sequence number alone. The replay
+ * thread samples it after every Delete, at most once per sample period,
+ * hence a lookup is off by less than one period. The period starts
+ * at `kSampleMicros`; when `kMaxSamples` are held every other sample is
+ * dropped and the period doubles, so the map stays bounded on long runs.
+ */
+class SeqnoTimeMap {
+ public:
+  static const uint64_t kSampleMicros = 1000;
+  static const size_t kMaxSamples = 1 << 16;
+
+  static SeqnoTimeMap *GetInstance();
+
+  void RecordDelete(DB *db);
+
+  /**
+   * Micros since epoch `seqno` was written at, 0 if it predates the samples
+   */
+  uint64_t TimeOf(SequenceNumber seqno);
+
+  static uint64_t NowMicros();
+
+ private:
+  SeqnoTimeMap() = default;
+
+  std::mutex mutex_;
+  std::map<SequenceNumber, uint64_t> samples_;
+  uint64_t last_sample_micros_ = 0;
+  uint64_t sample_micros_ = kSampleMicros;
+};
+
+/**
+ * Counts point and range tombstones of every SST and records the sequence
+ * number and write time of its oldest tombstone in the user collected
+ * properties (see `FadeFileInfo`)
+ */
+class TombstoneCollector : public TablePropertiesCollector {
+ public:
+  static const char *kPointTombstones;
+  static const char *kRangeTombstones;
+  static const char *kOldestTombstoneSeqno;
+  static const char *kOldestTombstoneTime;
+
+  Status AddUserKey(const Slice &key, const Slice &value, EntryType type,
+                    SequenceNumber seq, uint64_t file_size) override;
+  Status Finish(UserCollectedProperties *properties) override;
+  UserCollectedProperties GetReadableProperties() const override {
+    return UserCollectedProperties();
+  }
+  const char *Name() const override { return "TombstoneCollector"; }
+
+ private:
+  uint64_t point_tombstones_ = 0;
+  uint64_t range_tombstones_ = 0;
+  SequenceNumber oldest_seqno_ = std::numeric_limits<SequenceNumber>::max();
+};
+
+class TombstoneCollectorFactory : public TablePropertiesCollectorFactory {
+ public:
+  TablePropertiesCollector *CreateTablePropertiesCollector(
+      TablePropertiesCollectorFactory::Context /*context*/) override {
+    return new TombstoneCollector();
+  }
+  const char *Name() const override { return "TombstoneCollectorFactory"; }
+};
+
+#endif // TOMBSTONE_COLLECTOR_H_
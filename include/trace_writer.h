@@ -0,0 +1,112 @@
+#ifndef TRACE_WRITER_H_
+#define TRACE_WRITER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <rocksdb/db.h>
+#include <rocksdb/listener.h>
+
+using namespace rocksdb;
+
+/**
+ * Collects a Chrome trace-event timeline (loadable in Perfetto or
+ * chrome://tracing): sampled foreground ops, flushes, compactions with
+ * their levels and bytes, write stalls and memtable switches. Every thread
+ * appends to its own buffer, the file is written once at the end of the run.
+ *
+ * At most one writer is active at a time, see `Get`.
+ */
+class TraceWriter : public EventListener {
+ public:
+  TraceWriter(const std::string &path, long sample_every);
+  ~TraceWriter();
+
+  /**
+   * The active writer, nullptr when tracing is off
+   */
+  static TraceWriter *Get() { return active_.load(std::memory_order_acquire); }
+
+  /**
+   * Called by the replay thread after every op, keeps 1 in `sample_every`
+   */
+  inline void RecordOp(char operation, uint64_t latency_ns) {
+    if (++ops_seen_ % sample_every_ != 0) {
+      return;
+    }
+    uint64_t end_us = NowMicros();
+    uint64_t latency_us = latency_ns / 1000;
+    Complete(OpName(operation), "foreground",
+             end_us > latency_us ? end_us - latency_us : 0, latency_us, "");
+  }
+
+  /**
+   * Point in time event on the calling thread
+   */
+  void Instant(const std::string &name, const char *category,
+               const std::string &args_json);
+
+  void OnFlushBegin(DB *db, const FlushJobInfo &fji) override;
+  void OnFlushCompleted(DB *db, const FlushJobInfo &fji) override;
+  void OnCompactionBegin(DB *db, const CompactionJobInfo &ci) override;
+  void OnCompactionCompleted(DB *db, const CompactionJobInfo &ci) override;
+  void OnStallConditionsChanged(const WriteStallInfo &info) override;
+
+  /**
+   * Writes every buffered event, call once no background job runs anymore
+   */
+  bool Write();
+
+ private:
+  struct TraceEvent {
+    std::string name;
+    const char *category;
+    char phase;  // 'X' complete, 'i' instant
+    uint64_t ts_us;
+    uint64_t dur_us;
+    int tid;
+    std::string args_json;
+  };
+  struct ThreadBuffer {
+    int tid;
+    std::vector<TraceEvent> events;
+  };
+
+  // stalls get a track of their own instead of the thread reporting them
+  static const int kStallTrack = 0;
+
+  static const char *OpName(char operation);
+  uint64_t NowMicros() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+  ThreadBuffer *GetThreadBuffer();
+  void Complete(const std::string &name, const char *category,
+                uint64_t ts_us, uint64_t dur_us, const std::string &args_json,
+                int tid = -1);
+
+  static std::atomic<TraceWriter *> active_;
+
+  std::string path_;
+  long sample_every_;
+  uint64_t ops_seen_ = 0;  // replay thread only
+  std::chrono::steady_clock::time_point start_;
+
+  // guards the registry of thread buffers and the open spans
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+  std::unordered_map<int, uint64_t> flush_start_us_;
+  std::unordered_map<int, uint64_t> compaction_start_us_;
+  bool stalled_ = false;
+  bool stall_stopped_ = false;
+  uint64_t stall_start_us_ = 0;
+};
+
+#endif // TRACE_WRITER_H_
@@ -0,0 +1,75 @@
+#ifndef VISIBILITY_CHECKER_H_
+#define VISIBILITY_CHECKER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <rocksdb/db.h>
+#include <rocksdb/listener.h>
+
+#include "buffer.h"
+
+using namespace rocksdb;
+
+/**
+ * Correctness harness for custom compaction schemes (e.g. FluidLSM).
+ * Remembers the last write of 1 in `sample_every` keys and, after every
+ * completed compaction, reads them back to check that the latest value
+ * (or the deletion) is still what the DB returns.
+ *
+ * The check runs on the replay thread between two operations, so the
+ * expected state never races with the writes it describes.
+ */
+class VisibilityChecker : public EventListener {
+ public:
+  VisibilityChecker(long sample_every, std::shared_ptr<Buffer> &buffer)
+      : buffer_(buffer), sample_every_(std::max(sample_every, 1L)) {}
+
+  inline void RecordPut(const std::string &key, const std::string &value) {
+    if (IsSampled(key)) {
+      expected_[key] = {true, value};
+    }
+  }
+  inline void RecordDelete(const std::string &key) {
+    if (IsSampled(key)) {
+      expected_[key] = {false, std::string()};
+    }
+  }
+
+  /**
+   * Verifies the sampled keys if a compaction completed since the last call
+   */
+  void MaybeVerify(DB *db);
+
+  void OnCompactionCompleted(DB *db, const CompactionJobInfo &ci) override;
+
+  void PrintSummary();
+
+ private:
+  struct ExpectedValue {
+    bool present;
+    std::string value;
+  };
+
+  inline bool IsSampled(const std::string &key) const {
+    return std::hash<std::string>()(key) % sample_every_ == 0;
+  }
+  void Verify(DB *db);
+
+  // only log the first few violations, the counter keeps the rest
+  static const int kMaxReportedViolations = 20;
+
+  std::shared_ptr<Buffer> buffer_;
+  size_t sample_every_;
+  std::unordered_map<std::string, ExpectedValue> expected_;
+  std::atomic<uint64_t> compactions_completed_{0};
+  uint64_t compactions_verified_ = 0;
+  uint64_t keys_checked_ = 0;
+  uint64_t violations_ = 0;
+};
+
+#endif // VISIBILITY_CHECKER_H_
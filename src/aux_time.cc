@@ -12,6 +12,12 @@
 #include <aux_time.h>
 #include <cmath>
 
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
 #ifdef __MACH__
 #include <mach/clock.h>
 #include <mach/mach.h>
@@ -79,3 +85,61 @@ double getclock_diff_s(my_clock clk1, my_clock clk2)
 	  return (double)(clk2.tv_sec-clk1.tv_sec)+(double)(clk2.tv_nsec-clk1.tv_nsec)/1000000000;
 #endif
 }
+
+my_ticks_calibration_t my_ticks_calibration = {false, 1ull << 32, 0};
+
+static bool my_tsc_is_invariant()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+		return false;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	// Advanced Power Management: invariant TSC
+	return (edx & (1u << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+void my_ticks_calibrate()
+{
+	my_ticks_calibration.use_tsc = false;
+	my_ticks_calibration.mult = 1ull << 32;
+	my_ticks_calibration.overhead = 0;
+
+	if (my_tsc_is_invariant()) {
+		my_ticks_calibration.use_tsc = true;
+		// TSC ticks over ~20 ms of CLOCK_MONOTONIC, busy-waiting so the
+		// thread is not migrated mid-way by a sleep
+		uint64_t ns_begin = my_ticks_monotonic();
+		my_ticks tsc_begin = my_ticks_start();
+		uint64_t ns_end;
+		do {
+			ns_end = my_ticks_monotonic();
+		} while (ns_end - ns_begin < 20000000ull);
+		my_ticks tsc_end = my_ticks_stop();
+		if (tsc_end > tsc_begin) {
+			my_ticks_calibration.mult =
+			    (uint64_t)(((unsigned __int128)(ns_end - ns_begin) << 32) /
+			               (tsc_end - tsc_begin));
+		} else {
+			my_ticks_calibration.use_tsc = false;
+		}
+	}
+
+	// the cheapest of many empty intervals is what the timer itself costs
+	my_ticks overhead = ~0ull;
+	for (int i = 0; i < 10000; i++) {
+		my_ticks begin = my_ticks_start();
+		my_ticks end = my_ticks_stop();
+		overhead = std::min(overhead, end - begin);
+	}
+	my_ticks_calibration.overhead = overhead;
+}
+
+double my_ticks_overhead_ns()
+{
+	return (double)(((unsigned __int128)my_ticks_calibration.overhead *
+	                 my_ticks_calibration.mult) >> 32);
+}
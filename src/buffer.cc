@@ -1,13 +1,77 @@
 #include "buffer.h"
 
-std::list<Buffer *> Buffer::instances_;
-std::mutex Buffer::mutex_;
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-Buffer::Buffer(const std::string &filename, size_t limit)
-    : buffer_limit(limit) {
-  output_file.open(filename, std::ios::out | std::ios::trunc);
-  if (!output_file.is_open()) {
-    throw std::runtime_error("Failed to open output file: " + filename);
+#ifdef LOG_ZSTD
+#include <zstd.h>
+#endif
+
+std::atomic<Buffer *> Buffer::instances_[Buffer::kMaxInstances];
+bool Buffer::use_mmap_ = true;
+int Buffer::compression_level_ = 0;
+std::atomic<uint64_t> Buffer::next_id_{1};
+const std::ios_base::fmtflags Buffer::kDefaultFlags =
+    std::ios_base::skipws | std::ios_base::dec;
+
+namespace {
+// how late a record may reach the collector and still be written in order
+const uint64_t kReorderWindowNs = 2 * 1000 * 1000;
+
+uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+} // namespace
+
+Buffer::Buffer(const std::string &filename, size_t limit, size_t num_arenas)
+    : buffer_limit(std::max<size_t>(limit, 1)), id_(next_id_++) {
+  std::string path = filename;
+  if (compression_level_ > 0) {
+#ifdef LOG_ZSTD
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compression_level_);
+    cctx_ = cctx;
+    compressed_.resize(ZSTD_CStreamOutSize());
+    path += ".zst";
+#else
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: built without zstd, " << filename
+              << " is written uncompressed" << std::endl;
+#endif // LOG_ZSTD
+  }
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    throw std::runtime_error("Failed to open output file: " + path);
+  }
+
+  // a compressed stream cannot be appended to in place
+  if (use_mmap_ && !cctx_) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    window_size_ = (buffer_limit + page - 1) / page * page;
+    windows_.reset(new std::atomic<char *>[kMaxWindows]);
+    for (size_t i = 0; i < kMaxWindows; i++) {
+      windows_[i].store(nullptr, std::memory_order_relaxed);
+    }
+    mapped_ = Window(0) != nullptr;
+  }
+  if (!mapped_) {
+    arenas_.resize(std::max<size_t>(num_arenas, 2));
+    for (Arena &arena : arenas_) {
+      arena.data.reset(new char[buffer_limit]);
+      free_.push_back(&arena);
+    }
+    active_ = free_.front();
+    free_.pop_front();
+    writer_ = std::thread(&Buffer::WriterLoop, this);
+    collector_ = std::thread(&Buffer::CollectorLoop, this);
   }
 
   register_instance();
@@ -15,39 +79,405 @@ Buffer::Buffer(const std::string &filename, size_t limit)
 }
 
 Buffer::~Buffer() {
-  flush();
-  if (output_file.is_open()) {
-    output_file.close();
-  }
-
   unregister_instance();
+
+  if (mapped_) {
+    {
+      // the other threads are done with this Buffer, keep their last
+      // unterminated line too
+      std::lock_guard<std::mutex> lock(logs_mutex_);
+      for (auto &log : logs_) {
+        WriteMapped(log->line.data(), log->line.size());
+      }
+    }
+    for (size_t i = 0; i < kMaxWindows; i++) {
+      char *window = windows_[i].load();
+      if (window) {
+        munmap(window, window_size_);
+      }
+    }
+    // drop the unused tail of the last window
+    if (ftruncate(fd_, end_offset_.load()) != 0) {
+      std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                << "]: ftruncate failed: " << strerror(errno) << std::endl;
+    }
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(collector_mutex_);
+      stop_collector_ = true;
+    }
+    collector_cv_.notify_one();
+    collector_.join();
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(append_mutex_);
+      stop_ = true;
+    }
+    writer_cv_.notify_one();
+    writer_.join();
+    if (cctx_) {
+      WriteCompressed(nullptr, 0, true);
+    }
+  }
+#ifdef LOG_ZSTD
+  ZSTD_freeCCtx(static_cast<ZSTD_CCtx *>(cctx_));
+#endif // LOG_ZSTD
+  ::close(fd_);
 }
 
 Buffer &Buffer::operator<<(std::ostream &(*manip)(std::ostream &)) {
-  buffer << manip;
-  if (buffer.tellp() >= static_cast<std::streampos>(buffer_limit)) {
-    flush();
+  ThreadLog *log = Local();
+  if (manip == static_cast<std::ostream &(*)(std::ostream &)>(std::endl)) {
+    log->line.push_back('\n');
+    Commit(log);
+  } else if (manip !=
+             static_cast<std::ostream &(*)(std::ostream &)>(std::flush)) {
+    std::ostringstream &stream = Scratch(log);
+    stream.str("");
+    stream << manip;
+    log->line += stream.str();
   }
   return *this;
 }
 
+Buffer::ThreadLog *Buffer::Lookup() {
+  // every Buffer this thread has logged to; ids are never reused, so the
+  // entries of destroyed Buffers are simply never matched again
+  thread_local std::vector<std::pair<uint64_t, ThreadLog *>> known;
+  for (auto &entry : known) {
+    if (entry.first == id_) {
+      return entry.second;
+    }
+  }
+  ThreadLog *log = new ThreadLog();
+  {
+    std::lock_guard<std::mutex> lock(logs_mutex_);
+    logs_.emplace_back(log);
+  }
+  known.emplace_back(id_, log);
+  return log;
+}
+
+std::ostringstream &Buffer::Scratch(ThreadLog *log) {
+  if (!log->scratch) {
+    log->scratch.reset(new std::ostringstream());
+  }
+  return *log->scratch;
+}
+
+// producer side: hands the finished line to the collector, only waits when
+// the collector is a whole ring behind; memory-mapped Buffers write it out
+// right away instead
+void Buffer::Commit(ThreadLog *log) {
+  if (mapped_) {
+    WriteMapped(log->line.data(), log->line.size());
+    log->line.clear();
+    return;
+  }
+  size_t tail = log->tail.load(std::memory_order_relaxed);
+  while (tail - log->head.load(std::memory_order_acquire) ==
+         ThreadLog::kCapacity) {
+    WakeCollector();
+    std::this_thread::yield();
+  }
+  // the slot holds an emptied string of an earlier line, so the next line
+  // is formatted into capacity that is already there
+  ThreadLog::Record &record = log->ring[tail % ThreadLog::kCapacity];
+  record.ts_ns = NowNanos();
+  record.text.swap(log->line);
+  log->line.clear();
+  log->tail.store(tail + 1, std::memory_order_release);
+  if (tail + 1 - log->head.load(std::memory_order_relaxed) ==
+      ThreadLog::kCapacity / 2) {
+    WakeCollector();
+  }
+}
+
+void Buffer::WakeCollector() {
+  {
+    std::lock_guard<std::mutex> lock(collector_mutex_);
+    collect_requested_ = true;
+  }
+  collector_cv_.notify_one();
+}
+
+// sleeps until a ring is half full, a flush or the destructor asks for it
+void Buffer::CollectorLoop() {
+  std::unique_lock<std::mutex> lock(collector_mutex_);
+  while (true) {
+    collector_cv_.wait(lock, [this]() {
+      return stop_collector_ || flush_requests_ > flushes_done_ ||
+             collect_requested_;
+    });
+    collect_requested_ = false;
+    uint64_t requests = flush_requests_;
+    bool stop = stop_collector_;
+    lock.unlock();
+
+    Collect(stop || requests > flushes_done_);
+    if (stop) {
+      // the other threads are done with this Buffer, keep their last
+      // unterminated line too
+      std::lock_guard<std::mutex> logs_lock(logs_mutex_);
+      std::lock_guard<std::mutex> append_lock(append_mutex_);
+      for (auto &log : logs_) {
+        Append(log->line.data(), log->line.size());
+      }
+    }
+
+    lock.lock();
+    flushes_done_ = requests;
+    collected_cv_.notify_all();
+    if (stop) {
+      return;
+    }
+  }
+}
+
+// moves every published record into the merge heap, then writes out the
+// ones older than the reorder window (all of them if `everything`)
+void Buffer::Collect(bool everything) {
+  uint64_t horizon = NowNanos() - kReorderWindowNs;
+  std::vector<ThreadLog *> logs;
+  {
+    std::lock_guard<std::mutex> lock(logs_mutex_);
+    for (auto &log : logs_) {
+      logs.push_back(log.get());
+    }
+  }
+
+  auto later = std::greater<PendingRecord>();
+  for (ThreadLog *log : logs) {
+    size_t head = log->head.load(std::memory_order_relaxed);
+    size_t tail = log->tail.load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      // hand the slot an emptied string in place of the one it gives up
+      ThreadLog::Record &record = log->ring[head % ThreadLog::kCapacity];
+      std::string text;
+      if (!spare_texts_.empty()) {
+        text.swap(spare_texts_.back());
+        spare_texts_.pop_back();
+      }
+      text.swap(record.text);
+      pending_records_.push_back({record.ts_ns, next_seq_++, std::move(text)});
+      std::push_heap(pending_records_.begin(), pending_records_.end(), later);
+    }
+    log->head.store(tail, std::memory_order_release);
+  }
+
+  std::lock_guard<std::mutex> lock(append_mutex_);
+  while (!pending_records_.empty() &&
+         (everything || pending_records_.front().ts_ns <= horizon)) {
+    std::pop_heap(pending_records_.begin(), pending_records_.end(), later);
+    std::string &text = pending_records_.back().text;
+    Append(text.data(), text.size());
+    text.clear();
+    spare_texts_.push_back(std::move(text));
+    pending_records_.pop_back();
+  }
+}
+
+// called with append_mutex_ held, arena mode only
+void Buffer::Append(const char *data, size_t len) {
+  while (len > 0) {
+    if (active_->size == buffer_limit) {
+      SealActive();
+    }
+    size_t n = std::min(len, buffer_limit - active_->size);
+    std::memcpy(active_->data.get() + active_->size, data, n);
+    active_->size += n;
+    data += n;
+    len -= n;
+  }
+}
+
+// any thread: reserves `len` bytes of the file and copies them in, a line
+// may straddle two windows
+void Buffer::WriteMapped(const char *data, size_t len) {
+  // never reserve past the last window, or the file would get a hole of
+  // zeros that a later line is written after
+  size_t offset = end_offset_.load(std::memory_order_relaxed);
+  do {
+    if (offset + len > kMaxWindows * window_size_) {
+      if (!overflowed_.exchange(true)) {
+        std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                  << "]: log is full at " << offset
+                  << " bytes, dropping further lines" << std::endl;
+      }
+      return;
+    }
+  } while (!end_offset_.compare_exchange_weak(offset, offset + len,
+                                              std::memory_order_relaxed));
+  while (len > 0) {
+    char *window = Window(offset / window_size_);
+    if (!window) {
+      return;
+    }
+    size_t in_window = offset % window_size_;
+    size_t n = std::min(len, window_size_ - in_window);
+    std::memcpy(window + in_window, data, n);
+    offset += n;
+    data += n;
+    len -= n;
+  }
+}
+
+// maps window `index` on first use, growing the file to cover it; the file
+// only ever grows here, so a window mapped earlier never loses its pages
+char *Buffer::Window(size_t index) {
+  if (index >= kMaxWindows) {
+    return nullptr;
+  }
+  char *window = windows_[index].load(std::memory_order_acquire);
+  if (window) {
+    return window;
+  }
+  std::lock_guard<std::mutex> lock(map_mutex_);
+  window = windows_[index].load(std::memory_order_relaxed);
+  if (window) {
+    return window;
+  }
+  size_t end = (index + 1) * window_size_;
+  if (end > file_size_) {
+    if (ftruncate(fd_, end) != 0) {
+      std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                << "]: ftruncate failed: " << strerror(errno) << std::endl;
+      return nullptr;
+    }
+    file_size_ = end;
+  }
+  void *mapping = mmap(nullptr, window_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd_, index * window_size_);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: mmap failed: " << strerror(errno) << std::endl;
+    return nullptr;
+  }
+  window = static_cast<char *>(mapping);
+  windows_[index].store(window, std::memory_order_release);
+  return window;
+}
+
+// called with append_mutex_ held, hands the active arena to the writer and
+// takes a free one, waiting only if the writer is behind on all of them
+void Buffer::SealActive() {
+  full_.push_back(active_);
+  pending_++;
+  writer_cv_.notify_one();
+  std::unique_lock<std::mutex> lock(append_mutex_, std::adopt_lock);
+  free_cv_.wait(lock, [this]() { return !free_.empty(); });
+  lock.release();
+  active_ = free_.front();
+  free_.pop_front();
+}
+
+void Buffer::WriterLoop() {
+  std::unique_lock<std::mutex> lock(append_mutex_);
+  while (true) {
+    writer_cv_.wait(lock, [this]() { return stop_ || !full_.empty(); });
+    if (full_.empty()) {
+      return;
+    }
+    Arena *arena = full_.front();
+    full_.pop_front();
+    writing_++;
+    lock.unlock();
+
+    if (cctx_) {
+      WriteCompressed(arena->data.get(), arena->size, false);
+    } else {
+      WriteAll(arena->data.get(), arena->size);
+    }
+    arena->size = 0;
+
+    lock.lock();
+    writing_--;
+    pending_--;
+    free_.push_back(arena);
+    free_cv_.notify_all();
+  }
+}
+
+// also called from the signal handler, so errors go out with write(2)
+void Buffer::WriteAll(const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t written = ::write(fd_, data, len);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      const char message[] = "Error[" __FILE__ "]: write failed\n";
+      ssize_t rc = ::write(STDERR_FILENO, message, sizeof(message) - 1);
+      (void)rc;
+      return;
+    }
+    data += written;
+    len -= written;
+  }
+}
+
+// writer thread only; every arena is flushed to a block boundary so a
+// killed run still leaves a readable prefix, `end` closes the frame
+void Buffer::WriteCompressed(const char *data, size_t len, bool end) {
+#ifdef LOG_ZSTD
+  ZSTD_CCtx *cctx = static_cast<ZSTD_CCtx *>(cctx_);
+  ZSTD_inBuffer input = {data, len, 0};
+  size_t remaining;
+  do {
+    ZSTD_outBuffer output = {compressed_.data(), compressed_.size(), 0};
+    remaining = ZSTD_compressStream2(cctx, &output, &input,
+                                     end ? ZSTD_e_end : ZSTD_e_flush);
+    if (ZSTD_isError(remaining)) {
+      std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                << "]: zstd: " << ZSTD_getErrorName(remaining) << std::endl;
+      return;
+    }
+    WriteAll(compressed_.data(), output.pos);
+  } while (remaining != 0);
+#endif // LOG_ZSTD
+}
+
 void Buffer::flush() {
-  if (buffer.tellp() > 0) {
-    output_file << buffer.str();
-    output_file.flush();
-    buffer.str("");
-    buffer.clear();
+  if (mapped_) {
+    // every finished line is in the page cache already
+    return;
   }
+  {
+    std::unique_lock<std::mutex> lock(collector_mutex_);
+    uint64_t request = ++flush_requests_;
+    collector_cv_.notify_one();
+    collected_cv_.wait(lock, [this, request]() {
+      return flushes_done_ >= request || stop_collector_;
+    });
+  }
+  std::unique_lock<std::mutex> lock(append_mutex_);
+  if (active_->size > 0) {
+    lock.release();
+    SealActive();
+    lock = std::unique_lock<std::mutex>(append_mutex_, std::adopt_lock);
+  }
+  free_cv_.wait(lock, [this]() { return full_.empty() && writing_ == 0; });
 }
 
 void Buffer::register_instance() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  instances_.push_back(this);
+  for (auto &slot : instances_) {
+    Buffer *expected = nullptr;
+    if (slot.compare_exchange_strong(expected, this)) {
+      return;
+    }
+  }
+  std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+            << "]: too many open Buffers, this one is not kept on signals"
+            << std::endl;
 }
 
 void Buffer::unregister_instance() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  instances_.remove(this);
+  for (auto &slot : instances_) {
+    Buffer *expected = this;
+    if (slot.compare_exchange_strong(expected, nullptr)) {
+      return;
+    }
+  }
 }
 
 void Buffer::register_signals() {
@@ -55,17 +485,34 @@ void Buffer::register_signals() {
   std::signal(SIGINT, handle_signal);
 }
 
-void Buffer::handle_signal(int signal) {
-  std::lock_guard<std::mutex> lock(mutex_);
+// async-signal-safe: only atomics, ftruncate and write
+void Buffer::SignalFlush() {
+  if (mapped_) {
+    // every finished line is in the page cache already, only the zeroed
+    // tail of the window has to go; a line another thread was copying in
+    // at this very moment may be left partly zero
+    int rc = ftruncate(fd_, end_offset_.load(std::memory_order_relaxed));
+    (void)rc;
+    return;
+  }
+  // best effort: the active arena can only be written in order when no
+  // sealed arena is still waiting for the writer thread, and only as text.
+  // Records still in the per-thread rings or the collector's reorder heap
+  // are lost, the collector may be moving them at this very moment
+  if (pending_.load() == 0 && active_ && !cctx_) {
+    WriteAll(active_->data.get(), active_->size);
+  }
+}
 
-  for (Buffer *instance : instances_) {
-    try {
-      instance->flush();
-      std::cerr << "Flushed buffer due to signal: " << signal << std::endl;
-    } catch (const std::exception &e) {
-      std::cerr << "Failed to flush buffer during signal handling: " << e.what()
-                << std::endl;
+void Buffer::handle_signal(int signal) {
+  for (auto &slot : instances_) {
+    Buffer *instance = slot.load();
+    if (instance) {
+      instance->SignalFlush();
     }
   }
-  std::exit(signal);
-}
\ No newline at end of file
+  const char message[] = "Flushed buffers due to signal\n";
+  ssize_t rc = ::write(STDERR_FILENO, message, sizeof(message) - 1);
+  (void)rc;
+  _exit(signal);
+}
@@ -1,50 +1,232 @@
 #include "event_listners.h"
 
-std::mutex mtx;
-std::condition_variable cv;
-bool compaction_complete = false;
+#include <algorithm>
+#include <iostream>
 
 void WaitForCompactions(DB *db) {
-  std::unique_lock<std::mutex> lock(mtx);
-  uint64_t num_running_compactions;
-  uint64_t pending_compaction_bytes;
-  uint64_t num_pending_compactions;
-
-  while (!compaction_complete) {
-    // Check if there are ongoing or pending compactions
-    db->GetIntProperty("rocksdb.num-running-compactions",
-                       &num_running_compactions);
-    db->GetIntProperty("rocksdb.estimate-pending-compaction-bytes",
-                       &pending_compaction_bytes);
-    db->GetIntProperty("rocksdb.compaction-pending", &num_pending_compactions);
-    if (num_running_compactions == 0 && pending_compaction_bytes == 0 &&
-        num_pending_compactions == 0) {
-      break;
+  for (auto &listener : db->GetOptions().listeners) {
+    auto tracker = std::dynamic_pointer_cast<CompactionsListner>(listener);
+    if (tracker) {
+      tracker->WaitForIdle(db);
+      return;
     }
-    cv.wait_for(lock, std::chrono::milliseconds(10));
+  }
+  std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+            << "]: no CompactionsListner registered, not waiting" << std::endl;
+}
+
+void CompactionsListner::OnFlushBegin(DB *db, const FlushJobInfo &fji) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_flushes_++;
+  events_++;
+  cv_.notify_all();
+}
+
+void CompactionsListner::OnFlushCompleted(DB *db, const FlushJobInfo &fji) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_flushes_ = std::max(running_flushes_ - 1, 0);
+  events_++;
+  cv_.notify_all();
+}
+
+void CompactionsListner::OnCompactionBegin(DB *db,
+                                           const CompactionJobInfo &ci) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_compactions_++;
+  events_++;
+  cv_.notify_all();
+}
+
+void CompactionsListner::OnCompactionCompleted(DB *db,
+                                               const CompactionJobInfo &ci) {
+  // also called for failed compactions
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_compactions_ = std::max(running_compactions_ - 1, 0);
+  events_++;
+  cv_.notify_all();
+}
+
+void CompactionsListner::OnBackgroundError(BackgroundErrorReason reason,
+                                           Status * /*bg_error*/) {
+  // a failed flush never reports its completion
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (reason == BackgroundErrorReason::kFlush ||
+      reason == BackgroundErrorReason::kFlushNoWAL) {
+    running_flushes_ = std::max(running_flushes_ - 1, 0);
+  }
+  events_++;
+  cv_.notify_all();
+}
+
+void CompactionsListner::Notify() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_++;
+  cv_.notify_all();
+}
+
+bool CompactionsListner::HasPendingWork(DB *db) {
+  uint64_t flush_pending = 0, compaction_pending = 0;
+  db->GetIntProperty("rocksdb.mem-table-flush-pending", &flush_pending);
+  // with auto compactions off the picker's score means nothing
+  if (!db->GetOptions().disable_auto_compactions) {
+    db->GetIntProperty("rocksdb.compaction-pending", &compaction_pending);
+  }
+  return flush_pending > 0 || compaction_pending > 0;
+}
+
+void CompactionsListner::WaitForIdle(DB *db) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    uint64_t seen = events_;
+    bool running = running_flushes_ > 0 || running_compactions_ > 0;
+    std::function<bool()> external = external_pending_;
+
+    // the DB properties take the DB mutex, never hold ours meanwhile
+    lock.unlock();
+    bool pending = running || HasPendingWork(db) || (external && external());
+    lock.lock();
+
+    if (!pending && seen == events_) {
+      return;
+    }
+    // pending work always ends in an event; the timeout only guards
+    // against work RocksDB reports pending but never schedules
+    cv_.wait_for(lock, std::chrono::seconds(1),
+                 [&] { return events_ != seen; });
   }
 }
 
 void FlushListner::OnFlushCompleted(DB* db, const FlushJobInfo& fji) {
-  if (buffer_ != nullptr) {
-    // we are running normal workload
-    (*buffer_) << "buffer is full, flush finished info [num_entries]: " << fji.table_properties.num_entries;
-    (*buffer_) << "[Flush Stats] raw_key_size: " << fji.table_properties.raw_key_size
-              << ", raw_value_size: " << fji.table_properties.raw_value_size << std::endl;
-  } else {
+  if (buffer_ == nullptr) {
     // we are running sample workload and testing the flush time.
+    std::lock_guard<std::mutex> lock(mutex_);
     if (job_start_time.find(fji.job_id) != job_start_time.end()) {
-      job_end_time[fji.job_id] = std::chrono::high_resolution_clock::now();
+      job_end_time[fji.job_id] = std::chrono::steady_clock::now();
     }
+    return;
+  }
+
+  const Options& options = db->GetOptions();
+  const TableProperties& props = fji.table_properties;
+  uint64_t buffer_size = options.write_buffer_size;
+  // the SST holds what is left after dedup within the flushed memtables
+  uint64_t sst_user_bytes = props.raw_key_size + props.raw_value_size;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  FlushStart start = {0, 0};
+  auto it = flush_start_.find(fji.job_id);
+  if (it != flush_start_.end()) {
+    start = it->second;
+    flush_start_.erase(it);
+  }
+
+  // the flushed memtables are the sealed ones from the one holding the
+  // smallest seqno up to the largest seqno of the output
+  std::string configured = options.memtable_factory
+                               ? options.memtable_factory->Name()
+                               : "unknown";
+  std::string rep;
+  uint64_t memtables = 0, entries = 0, deletes = 0, user_bytes = 0;
+  auto first = sealed_.upper_bound(fji.smallest_seqno);
+  if (first != sealed_.begin()) {
+    --first;
+  }
+  auto last = sealed_.upper_bound(fji.largest_seqno);
+  for (auto sealed = first; sealed != last; ++sealed) {
+    const SealedMemTable& memtable = sealed->second;
+    memtables++;
+    entries += memtable.entries;
+    deletes += memtable.deletes;
+    user_bytes += memtable.user_bytes;
+    const std::string& name = memtable.rep.empty() ? configured : memtable.rep;
+    if (("+" + rep + "+").find("+" + name + "+") == std::string::npos) {
+      rep += (rep.empty() ? "" : "+") + name;
+    }
+  }
+  sealed_.erase(sealed_.begin(), last);
+  if (memtables == 0) {
+    // never saw the seal, the SST counts are all there is
+    rep = configured;
+    memtables = 1;
+    entries = props.num_entries;
+    deletes = props.num_deletions;
+    user_bytes = sst_user_bytes;
   }
-}
 
+  double fill = buffer_size > 0 ? (double)user_bytes / (buffer_size * memtables)
+                                : 0;
+  double arena_fill = start.avg_arena_bytes > 0
+                          ? (double)user_bytes /
+                                (start.avg_arena_bytes * memtables)
+                          : 0;
+
+  FillTotals& totals = fill_by_rep_[rep];
+  totals.flushes++;
+  totals.fill += fill;
+  totals.arena_fill += arena_fill;
+
+  (*buffer_) << "[Flush] job=" << fji.job_id
+             << " reason=" << GetFlushReasonString(fji.flush_reason)
+             << " memtable=" << rep << " memtables=" << memtables
+             << " write_buffer_size=" << buffer_size
+             << " avg_arena_bytes=" << start.avg_arena_bytes
+             << " user_bytes=" << user_bytes << " entries=" << entries
+             << " deletes=" << deletes << " sst_user_bytes=" << sst_user_bytes
+             << " sst_entries=" << props.num_entries
+             << " sst_deletes=" << props.num_deletions << " fill=" << fill
+             << " arena_fill=" << arena_fill
+             << " immutable_memtables=" << start.immutable_memtables
+             << std::endl;
+}
 
 void FlushListner::OnFlushBegin(DB* db, const FlushJobInfo& fji) {
   if (buffer_ == nullptr) {
     // we are running sample workload and testing the flush time.
+    std::lock_guard<std::mutex> lock(mutex_);
     if (job_start_time.find(fji.job_id) == job_start_time.end()) {
-      job_start_time[fji.job_id] = std::chrono::high_resolution_clock::now();
+      job_start_time[fji.job_id] = std::chrono::steady_clock::now();
     }
+    return;
+  }
+
+  // the immutable memtables are the ones waiting for (or in) a flush
+  uint64_t all_memtables = 0, active_memtable = 0, immutable_memtables = 0;
+  db->GetIntProperty("rocksdb.size-all-mem-tables", &all_memtables);
+  db->GetIntProperty("rocksdb.cur-size-active-mem-table", &active_memtable);
+  db->GetIntProperty("rocksdb.num-immutable-mem-table", &immutable_memtables);
+  uint64_t avg_arena_bytes =
+      all_memtables > active_memtable
+          ? (all_memtables - active_memtable) /
+                std::max<uint64_t>(immutable_memtables, 1)
+          : 0;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  flush_start_[fji.job_id] = {avg_arena_bytes, immutable_memtables};
+}
+
+void FlushListner::OnMemTableSealed(const MemTableInfo& info) {
+  if (buffer_ == nullptr) {
+    return;
+  }
+  // runs before the next memtable is built, so the source still names
+  // the rep of the sealed one; the write that sealed it is counted after
+  // it returns, towards the next one
+  SealedMemTable sealed = {rep_source_ ? rep_source_() : "", info.num_entries,
+                           info.num_deletes, written_bytes_.exchange(0)};
+  std::lock_guard<std::mutex> lock(mutex_);
+  sealed_[info.first_seqno] = std::move(sealed);
+}
+
+void FlushListner::PrintSummary() {
+  if (buffer_ == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& rep : fill_by_rep_) {
+    (*buffer_) << "[Flush] summary memtable=" << rep.first
+               << " flushes=" << rep.second.flushes
+               << " avg_fill=" << rep.second.fill / rep.second.flushes
+               << " avg_arena_fill="
+               << rep.second.arena_fill / rep.second.flushes << std::endl;
   }
 }
@@ -0,0 +1,206 @@
+#include "fade_controller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include <rocksdb/utilities/debug.h>
+
+#include "stats.h"
+#include "stats_collector.h"
+#include "tombstone_collector.h"
+
+FadeController::FadeController(double threshold_s, double size_ratio,
+                               std::shared_ptr<FluidLSM> tree,
+                               std::shared_ptr<Buffer> &buffer)
+    : threshold_s_(threshold_s),
+      size_ratio_(std::max(size_ratio, 2.0)),
+      tree_(tree),
+      buffer_(buffer) {}
+
+FadeController::~FadeController() { Stop(); }
+
+void FadeController::RecordDelete(DB *db, const std::string &key) {
+  if (std::hash<std::string>()(key) % kSampleEvery != 0) {
+    return;
+  }
+  // the replay thread is the only writer, so this is the Delete's seqno
+  TrackedTombstone tombstone{key, db->GetLatestSequenceNumber(),
+                             SeqnoTimeMap::NowMicros()};
+  std::lock_guard<std::mutex> lock(tracked_mutex_);
+  if (tracked_.size() >= kMaxTracked) {
+    dropped_samples_++;
+    return;
+  }
+  tracked_.push_back(tombstone);
+}
+
+void FadeController::OnFlushCompleted(DB * /*db*/,
+                                      const FlushJobInfo & /*fji*/) {
+  tree_changed_ = true;
+}
+
+void FadeController::OnCompactionCompleted(DB * /*db*/,
+                                           const CompactionJobInfo &ci) {
+  if (ci.status.ok()) {
+    compaction_completed_ = true;
+    tree_changed_ = true;
+  }
+}
+
+void FadeController::Start(DB *db) {
+  if (thread_.joinable()) {
+    return;
+  }
+  stop_ = false;
+  thread_ = std::thread(&FadeController::Run, this, db);
+}
+
+void FadeController::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void FadeController::Run(DB *db) {
+  // a few checks within the deadline of the smallest level
+  long period_ms = std::max(
+      10L, std::min(1000L, (long)(threshold_s_ * 1000 / 20)));
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, std::chrono::milliseconds(period_ms),
+                       [this] { return stop_; })) {
+    CompactExpired(db);
+    if (compaction_completed_.exchange(false)) {
+      CheckPurged(db);
+    }
+  }
+}
+
+int FadeController::LogicalLevel(int RocksDB_lvl) const {
+  if (!tree_ || RocksDB_lvl == 0) {
+    return RocksDB_lvl;
+  }
+  int runs = tree_->GetSmallerLevelRunsCount() + 1;
+  return (RocksDB_lvl - 1 + runs - 1) / runs;
+}
+
+double FadeController::LevelDeadline(int lvl, int num_levels) const {
+  if (lvl + 1 >= num_levels) {
+    return threshold_s_;
+  }
+  return threshold_s_ * (std::pow(size_ratio_, lvl + 1) - 1) /
+         (std::pow(size_ratio_, num_levels) - 1);
+}
+
+void FadeController::CompactExpired(DB *db) {
+  // reading the table properties of every file is costly, between
+  // flushes and compactions the cached ages just grow with the clock
+  if (tree_changed_.exchange(false)) {
+    StatsCollector::Refresh(db);
+  }
+
+  std::string file_name;
+  int file_level = -1, bottom_level = 0;
+  {
+    Stats *stats = Stats::getInstance();
+    std::lock_guard<std::mutex> lock(stats->tree_mutex);
+    if (stats->levels_in_tree <= 0) {
+      return;
+    }
+    double elapsed_s =
+        (SeqnoTimeMap::NowMicros() - stats->fade_file_info_micros) / 1e6;
+    bottom_level = stats->levels_in_tree - 1;
+    int num_levels = LogicalLevel(bottom_level) + 1;
+    double most_overdue = 0;
+    for (auto &file : stats->fade_file_info) {
+      if (file.oldest_tombstone_age < 0) {
+        continue;
+      }
+      double overdue =
+          file.oldest_tombstone_age + elapsed_s -
+          LevelDeadline(LogicalLevel(file.file_level), num_levels);
+      file.file_ttl_expired = overdue > 0;
+      if (overdue > most_overdue) {
+        most_overdue = overdue;
+        file_name = file.file_id;
+        file_level = file.file_level;
+      }
+    }
+  }
+  if (file_level < 0) {
+    return;
+  }
+  overdue_checks_++;
+
+  if (tree_) {
+    tree_->RequestCompaction(db, file_level);
+    triggered_compactions_++;
+    return;
+  }
+  // the last level rewrites the file in place, which drops its tombstones
+  int output_level = std::min(file_level + 1, bottom_level);
+  output_level = std::max(output_level, file_level == 0 ? 1 : file_level);
+  Status s = db->CompactFiles(CompactionOptions(), {file_name}, output_level);
+  if (s.ok()) {
+    triggered_compactions_++;
+  } else {
+    // most often the file was picked by RocksDB in the meantime
+    failed_compactions_++;
+  }
+}
+
+void FadeController::CheckPurged(DB *db) {
+  std::vector<TrackedTombstone> to_check;
+  {
+    std::lock_guard<std::mutex> lock(tracked_mutex_);
+    size_t n = std::min(tracked_.size(), kMaxChecksPerRound);
+    to_check.assign(tracked_.begin(), tracked_.begin() + n);
+    tracked_.erase(tracked_.begin(), tracked_.begin() + n);
+  }
+
+  std::vector<TrackedTombstone> still_present;
+  uint64_t now = SeqnoTimeMap::NowMicros();
+  for (auto &tombstone : to_check) {
+    std::vector<KeyVersion> versions;
+    Status s = GetAllKeyVersions(db, tombstone.key, tombstone.key,
+                                 std::numeric_limits<size_t>::max(),
+                                 &versions);
+    bool present = !s.ok();
+    for (auto &version : versions) {
+      present |= version.sequence == tombstone.seqno;
+    }
+    if (present) {
+      still_present.push_back(tombstone);
+    } else {
+      persistence_latency_ms_.Add((now - tombstone.time_micros) / 1000);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(tracked_mutex_);
+  tracked_.insert(tracked_.begin(), still_present.begin(),
+                  still_present.end());
+}
+
+void FadeController::PrintSummary() {
+  uint64_t now = SeqnoTimeMap::NowMicros();
+  std::lock_guard<std::mutex> lock(tracked_mutex_);
+  double oldest_s =
+      tracked_.empty() ? 0 : (now - tracked_.front().time_micros) / 1e6;
+  (*buffer_) << "[FADE] dpth_s=" << threshold_s_
+             << " overdue_checks=" << overdue_checks_
+             << " triggered_compactions=" << triggered_compactions_
+             << " failed_compactions=" << failed_compactions_
+             << " purged_tombstones=" << persistence_latency_ms_.Count()
+             << " unpurged_tombstones=" << tracked_.size()
+             << " oldest_unpurged_s=" << oldest_s
+             << " dropped_samples=" << dropped_samples_ << std::endl;
+  (*buffer_) << "[FADE] delete_persistence_latency_ms("
+             << persistence_latency_ms_.ToString() << ")" << std::endl;
+}
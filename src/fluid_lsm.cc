@@ -1,6 +1,14 @@
+#include <db_env.h>
 #include <fluid_lsm.h>
+#include <stats.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <utility>
 
 using namespace std;
 
@@ -11,6 +19,21 @@ void Run::AddFile(SstFileMetaData file) {
   file_names_.insert(file.name);
 }
 
+size_t Run::RemoveFiles(const std::set<std::string>& names) {
+  size_t removed = 0;
+  files_.erase(std::remove_if(files_.begin(), files_.end(),
+                              [&](const SstFileMetaData& file) {
+                                if (!names.count(file.name)) {
+                                  return false;
+                                }
+                                file_names_.erase(file.name);
+                                removed++;
+                                return true;
+                              }),
+               files_.end());
+  return removed;
+}
+
 int LazyLevel::NumLiveRuns() {
   int num_live_runs = 0;
 
@@ -39,26 +62,65 @@ long LazyLevel::SizeInBytes() {
   return size_in_bytes;
 }
 
+const char* KeyRangeCollector::kSmallestKey = "fluidlsm.smallest.key";
+const char* KeyRangeCollector::kLargestKey = "fluidlsm.largest.key";
+
+Status KeyRangeCollector::AddUserKey(const Slice& key, const Slice& /*value*/,
+                                     EntryType type, SequenceNumber /*seq*/,
+                                     uint64_t /*file_size*/) {
+  // range tombstones are not part of the point key order
+  if (type == kEntryRangeDeletion) {
+    return Status::OK();
+  }
+  if (empty_) {
+    smallest_.assign(key.data(), key.size());
+    empty_ = false;
+  }
+  largest_.assign(key.data(), key.size());
+  return Status::OK();
+}
+
+Status KeyRangeCollector::Finish(UserCollectedProperties* properties) {
+  if (!empty_) {
+    (*properties)[kSmallestKey] = smallest_;
+    (*properties)[kLargestKey] = largest_;
+  }
+  return Status::OK();
+}
+
 FluidLSM::FluidLSM(int size_ratio, int smaller_lvl_runs_count /* K */,
                    int larger_lvl_runs_count /* Z */, long file_size,
-                   const Options options)
+                   const Options options, int parallel_compactions)
     : size_ratio_(size_ratio),
       smaller_lvl_runs_count_(smaller_lvl_runs_count),
       larger_lvl_runs_count_(larger_lvl_runs_count),
       file_size_(file_size),
       options_(options),
       compact_options_(),
-      parallel_compactions_allowed_(1),
-      parallel_compactions_running_(0) {
+      parallel_compactions_allowed_(std::max(1, parallel_compactions)),
+      parallel_compactions_running_(0),
+      debug_mode_(false) {
   compact_options_.compression = options_.compression;
   compact_options_.output_file_size_limit = options_.target_file_size_base;
   lazy_levels_.resize(options_.num_levels);
+  partial_rounds_.resize(options_.num_levels);
+  // compactions run on the LOW pool next to RocksDB's own background jobs,
+  // make sure it is wide enough to run all of them at once
+  options_.env->IncBackgroundThreadsIfNeeded(parallel_compactions_allowed_,
+                                             Env::Priority::LOW);
 }
 
-void FluidLSM::CreateRun(DB* db, std::vector<SstFileMetaData> const& file_names,
+void FluidLSM::SetPendingTuning(int size_ratio, int smaller_lvl_runs_count,
+                                int larger_lvl_runs_count) {
+  std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+  has_pending_tuning_ = true;
+  pending_size_ratio_ = size_ratio;
+  pending_smaller_lvl_runs_count_ = smaller_lvl_runs_count;
+  pending_larger_lvl_runs_count_ = larger_lvl_runs_count;
+}
+
+void FluidLSM::CreateRun(std::vector<SstFileMetaData> const& file_names,
                          int lvl, int RocksDB_lvl) {
-  ColumnFamilyMetaData cf_meta;
-  db->GetColumnFamilyMetaData(&cf_meta);
   Run run(RocksDB_lvl);
 
   for (SstFileMetaData file : file_names) {
@@ -69,10 +131,18 @@ void FluidLSM::CreateRun(DB* db, std::vector<SstFileMetaData> const& file_names,
 }
 
 void FluidLSM::BuildStructure(DB* db) {
-  lazy_levels_mutex_.lock();
+  std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+  BuildStructureLocked(db);
+}
+
+void FluidLSM::BuildStructureLocked(DB* db) {
   ColumnFamilyMetaData cf_meta;
-  db->GetColumnFamilyMetaData(&cf_meta);
+  GetMetadata(db, &cf_meta);
+  BuildStructureFromMetadata(cf_meta);
+}
 
+void FluidLSM::BuildStructureFromMetadata(
+    const ColumnFamilyMetaData& cf_meta) {
   for (int lvl = 0; lvl < lazy_levels_.size(); lvl++) {
     lazy_levels_[lvl].Clear();
   }
@@ -82,19 +152,19 @@ void FluidLSM::BuildStructure(DB* db) {
 
   std::vector<SstFileMetaData> file_names;
   for (unsigned long i = num_runs_in_lvl1; i < smaller_lvl_runs_count_; i++) {
-    CreateRun(db, file_names, 0, 0);
+    CreateRun(file_names, 0, 0);
   }
 
   for (auto file : cf_meta.levels[0].files) {
     file_names.push_back(file);
-    CreateRun(db, file_names, 0, 0);
+    CreateRun(file_names, 0, 0);
     file_names.clear();
   }
 
   for (auto file : cf_meta.levels[1].files) {
     file_names.push_back(file);
   }
-  CreateRun(db, file_names, 0, 1);
+  CreateRun(file_names, 0, 1);
   file_names.clear();
 
   for (int lvl = 2; lvl < cf_meta.levels.size(); lvl++) {
@@ -106,9 +176,233 @@ void FluidLSM::BuildStructure(DB* db) {
     for (auto file : level.files) {
       file_names.push_back(file);
     }
-    CreateRun(db, file_names, fluid_lvl, level.level);
+    CreateRun(file_names, fluid_lvl, level.level);
+  }
+
+  // CompactFiles marks its inputs only once it starts running
+  for (auto& lazy_level : lazy_levels_) {
+    for (auto& run : lazy_level.runs) {
+      for (auto& file : run.files_) {
+        file.being_compacted |= compacting_files_.count(file.name) > 0;
+      }
+    }
+  }
+}
+
+void FluidLSM::GetMetadata(DB* db, ColumnFamilyMetaData* cf_meta) {
+  db->GetColumnFamilyMetaData(cf_meta);
+}
+
+void FluidLSM::VerifyStructureLocked(DB* db) {
+  std::set<std::pair<std::string, int>> view_files;
+  for (auto& lazy_level : lazy_levels_) {
+    for (auto& run : lazy_level.runs) {
+      for (auto& name : run.file_names_) {
+        view_files.insert({name, run.RocksDB_level_});
+      }
+    }
+  }
+
+  BuildStructureLocked(db);
+
+  if (view_valid_) {
+    long mismatches = 0;
+    for (auto& lazy_level : lazy_levels_) {
+      for (auto& run : lazy_level.runs) {
+        for (auto& name : run.file_names_) {
+          mismatches += view_files.erase({name, run.RocksDB_level_}) == 0;
+        }
+      }
+    }
+    mismatches += view_files.size();
+    consistency_mismatches_ += mismatches;
+
+    if (debug_mode_ && mismatches > 0) {
+      cerr << "FluidLSM view was off by " << mismatches
+           << " files, rebuilt from metadata" << endl;
+    }
+  }
+
+  view_valid_ = true;
+  picks_since_check_ = 0;
+}
+
+Run* FluidLSM::GetRunOfRocksDBLevel(int RocksDB_lvl) {
+  int fluid_lvl =
+      RocksDB_lvl <= 1 ? 0
+                       : ceil(((double)RocksDB_lvl - 1) /
+                              ((double)smaller_lvl_runs_count_ + 1.0));
+  if (RocksDB_lvl == 0 || fluid_lvl >= lazy_levels_.size()) {
+    return nullptr;
+  }
+
+  for (auto& run : lazy_levels_[fluid_lvl].runs) {
+    if (run.RocksDB_level_ == RocksDB_lvl) {
+      return &run;
+    }
+  }
+  return nullptr;
+}
+
+void FluidLSM::NormalizeLevelZero() {
+  // same shape as BuildStructure: empty L0 runs pad the level up to K runs
+  // in front of the L0 files (newest first) and the L1 run
+  std::vector<Run>& runs = lazy_levels_[0].runs;
+  runs.erase(std::remove_if(runs.begin(), runs.end(),
+                            [](const Run& run) {
+                              return run.RocksDB_level_ == 0 &&
+                                     run.files_.empty();
+                            }),
+             runs.end());
+
+  int num_runs = 0;
+  for (auto& run : runs) {
+    num_runs += !run.files_.empty();
+  }
+  for (int i = num_runs; i < smaller_lvl_runs_count_; i++) {
+    runs.insert(runs.begin(), Run(0));
+  }
+}
+
+bool FluidLSM::AddFileToView(SstFileMetaData file, int RocksDB_lvl) {
+  if (RocksDB_lvl == 0) {
+    Run run(0);
+    run.AddFile(file);
+    lazy_levels_[0].runs.insert(lazy_levels_[0].runs.begin(), run);
+    NormalizeLevelZero();
+    return true;
+  }
+
+  Run* run = GetRunOfRocksDBLevel(RocksDB_lvl);
+  if (run == nullptr || run->file_names_.count(file.name)) {
+    return false;
+  }
+
+  // keep the run sorted by key like the RocksDB level it mirrors
+  auto pos = std::upper_bound(
+      run->files_.begin(), run->files_.end(), file,
+      [](const SstFileMetaData& a, const SstFileMetaData& b) {
+        return a.smallestkey < b.smallestkey;
+      });
+  run->files_.insert(pos, file);
+  run->file_names_.insert(file.name);
+
+  if (RocksDB_lvl == 1) {
+    NormalizeLevelZero();
+  }
+  return true;
+}
+
+bool FluidLSM::RemoveFilesFromView(const std::set<std::string>& names,
+                                   int RocksDB_lvl) {
+  size_t removed = 0;
+  if (RocksDB_lvl == 0) {
+    std::vector<Run>& runs = lazy_levels_[0].runs;
+    runs.erase(std::remove_if(runs.begin(), runs.end(),
+                              [&](const Run& run) {
+                                if (run.RocksDB_level_ != 0 ||
+                                    run.files_.empty() ||
+                                    !names.count(run.files_[0].name)) {
+                                  return false;
+                                }
+                                removed++;
+                                return true;
+                              }),
+               runs.end());
+    NormalizeLevelZero();
+    return removed == names.size();
+  }
+
+  Run* run = GetRunOfRocksDBLevel(RocksDB_lvl);
+  if (run == nullptr) {
+    return false;
+  }
+  removed = run->RemoveFiles(names);
+
+  if (RocksDB_lvl == 1) {
+    NormalizeLevelZero();
+  }
+  return removed == names.size();
+}
+
+void FluidLSM::MoveFilesInView(std::vector<std::string> const& file_names,
+                               int RocksDB_lvl) {
+  for (auto& path : file_names) {
+    std::string name = FileName(path);
+    SstFileMetaData file;
+    int from_lvl = -1;
+    for (auto& lazy_level : lazy_levels_) {
+      for (auto& run : lazy_level.runs) {
+        if (!run.file_names_.count(name)) {
+          continue;
+        }
+        for (auto& f : run.files_) {
+          if (f.name == name) {
+            file = f;
+          }
+        }
+        from_lvl = run.RocksDB_level_;
+      }
+    }
+    // the compaction listener may have applied the move already
+    if (from_lvl == RocksDB_lvl) {
+      continue;
+    }
+    view_valid_ = view_valid_ && from_lvl >= 0 &&
+                  RemoveFilesFromView({name}, from_lvl) &&
+                  AddFileToView(file, RocksDB_lvl);
+  }
+}
+
+std::string FluidLSM::FileName(const std::string& path) {
+  size_t pos = path.find_last_of('/');
+  return pos == std::string::npos ? "/" + path : path.substr(pos);
+}
+
+SstFileMetaData FluidLSM::MakeFileMetaData(
+    const std::string& path, const TableProperties* props) const {
+  SstFileMetaData file;
+  file.name = FileName(path);
+  file.relative_filename = file.name.substr(1);
+  file.db_path = path.substr(0, path.size() - file.name.size());
+  file.directory = file.db_path;
+  file.file_number = strtoull(file.relative_filename.c_str(), nullptr, 10);
+  options_.env->GetFileSize(path, &file.size);
+
+  if (props != nullptr) {
+    file.num_entries = props->num_entries;
+    file.num_deletions = props->num_deletions;
+
+    auto& user_props = props->user_collected_properties;
+    auto smallest = user_props.find(KeyRangeCollector::kSmallestKey);
+    auto largest = user_props.find(KeyRangeCollector::kLargestKey);
+    if (smallest != user_props.end() && largest != user_props.end()) {
+      file.smallestkey = smallest->second;
+      file.largestkey = largest->second;
+    }
+  }
+  return file;
+}
+
+void FluidLSM::ReleaseFiles(std::vector<std::string> const& file_names) {
+  for (auto& name : file_names) {
+    if (compacting_files_.erase(name) == 0) {
+      continue;
+    }
+    // inputs of a successful compaction are already gone from the view
+    for (auto& lazy_level : lazy_levels_) {
+      for (auto& run : lazy_level.runs) {
+        if (!run.file_names_.count(name)) {
+          continue;
+        }
+        for (auto& file : run.files_) {
+          if (file.name == name) {
+            file.being_compacted = false;
+          }
+        }
+      }
+    }
   }
-  lazy_levels_mutex_.unlock();
 }
 
 int FluidLSM::GetLargestOccupiedLevel() const {
@@ -152,9 +446,6 @@ void FluidLSM::PrintFluidLSM(DB* db) {
 
 void FluidLSM::AddFilesToCompaction(
     DB* db, int lvl, std::vector<SstFileMetaData*>& input_file_names) {
-  ColumnFamilyMetaData cf_name;
-  db->GetColumnFamilyMetaData(&cf_name);
-
   for (auto& run : lazy_levels_[lvl].runs) {
     for (auto& file : run.files_) {
       if (file.being_compacted == false) {
@@ -194,9 +485,47 @@ void FluidLSM::CompactFiles(void* args) {
   std::unique_ptr<CompactionTask> task(reinterpret_cast<CompactionTask*>(args));
   assert(task && task->db_);
   std::vector<std::string>* output_file_names = new std::vector<std::string>();
-  Status s =
-      task->db_->CompactFiles(task->compact_options_, task->input_file_names_,
-                              task->output_lvl_, -1, output_file_names);
+  auto start = std::chrono::steady_clock::now();
+
+  // a move keeps the file number, so the output names match the inputs
+  std::vector<size_t> moved_groups, rewritten_groups;
+  Status s;
+  for (size_t i = 0; i < task->trivial_moves_.size() && s.ok(); i++) {
+    CompactionOptions move_options = task->compact_options_;
+    move_options.allow_trivial_move = true;
+    std::vector<std::string> moved_names;
+    s = task->db_->CompactFiles(move_options, task->trivial_moves_[i],
+                                task->output_lvl_, -1, &moved_names);
+    std::set<std::string> inputs;
+    for (auto& name : task->trivial_moves_[i]) {
+      inputs.insert(FileName(name));
+    }
+    long same = 0;
+    for (auto& name : moved_names) {
+      same += inputs.count(FileName(name));
+    }
+    if (s.ok() && same == (long)task->trivial_moves_[i].size()) {
+      moved_groups.push_back(i);
+    } else if (s.ok()) {
+      // RocksDB did not honor allow_trivial_move and rewrote the files
+      rewritten_groups.push_back(i);
+    }
+    if (task->debug_mode_) {
+      cerr << "trivial move of " << task->trivial_moves_[i].size()
+           << " files -> level " << task->output_lvl_ << " "
+           << (same == (long)task->trivial_moves_[i].size() ? "moved"
+                                                            : "rewritten")
+           << " status " << s.ToString() << endl;
+    }
+  }
+  if (s.ok() && !task->input_file_names_.empty()) {
+    s = task->db_->CompactFiles(task->compact_options_,
+                                task->input_file_names_, task->output_lvl_,
+                                -1, output_file_names);
+  }
+  uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
 
   if (task->debug_mode_) {
     for (auto name : *output_file_names) {
@@ -211,88 +540,492 @@ void FluidLSM::CompactFiles(void* args) {
   }
   FluidLSM* tree = reinterpret_cast<FluidLSM*>(task->compactor_);
 
+  {
+    std::lock_guard<std::mutex> lock(tree->lazy_levels_mutex_);
+    tree->FinishCompactionLocked(task.get(), s.ok(), duration, moved_groups,
+                                 rewritten_groups);
+  }
+
   if (!s.IsIOError()) {
     tree->PickCompaction(task->db_, task->cf_name_);
   }
+  if (tree->idle_callback_) {
+    tree->idle_callback_();
+  }
+}
 
-  tree->parallel_compactions_mutex_.lock();
-  tree->parallel_compactions_running_--;
-  tree->parallel_compactions_mutex_.unlock();
+void FluidLSM::FinishCompactionLocked(
+    CompactionTask* task, bool ok, uint64_t duration,
+    std::vector<size_t> const& moved_groups,
+    std::vector<size_t> const& rewritten_groups) {
+  parallel_compactions_running_--;
+  if (ok && !task->input_file_names_.empty()) {
+    compaction_bytes_.Add(task->input_bytes_);
+    compaction_durations_.Add(duration);
+  }
+  long moved_files = 0, moved_bytes = 0;
+  for (size_t i : moved_groups) {
+    moved_files += task->trivial_moves_[i].size();
+    moved_bytes += task->trivial_move_bytes_[i];
+    MoveFilesInView(task->trivial_moves_[i], task->output_lvl_);
+  }
+  if (moved_files > 0) {
+    trivial_moves_ += moved_files;
+    trivial_move_bytes_ += moved_bytes;
+    Stats* stats = Stats::getInstance();
+    stats->compactions_by_pointer_manipulation += moved_files;
+    stats->bytes_saved_by_pointer_manipulation += moved_bytes;
+  }
+  for (size_t i : rewritten_groups) {
+    rewritten_moves_ += task->trivial_moves_[i].size();
+    rewritten_move_bytes_ += task->trivial_move_bytes_[i];
+  }
+  for (auto& group : task->trivial_moves_) {
+    ReleaseFiles(group);
+  }
+  busy_levels_.erase(task->origin_lazy_lvl_);
+  busy_levels_.erase(task->target_lazy_lvl_);
+  // a failed compaction leaves its inputs in place, make them pickable
+  ReleaseFiles(task->input_file_names_);
+}
+
+bool FluidLSM::HasPendingWork() {
+  std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+  return parallel_compactions_running_ > 0 || !pending_compactions_.empty();
+}
+
+int FluidLSM::GetTargetSlot(int origin_lvl, int target_lvl) {
+  int RocksDB_lvl = 1 + target_lvl * (smaller_lvl_runs_count_ + 1);
+
+  for (int lvl = 0; lvl <= smaller_lvl_runs_count_ && target_lvl > origin_lvl;
+       lvl++) {
+    size_t run_idx = smaller_lvl_runs_count_ - lvl;
+    if (run_idx < lazy_levels_[target_lvl].runs.size() &&
+        lazy_levels_[target_lvl].runs[run_idx].files_.empty()) {
+      RocksDB_lvl = 1 + target_lvl * (smaller_lvl_runs_count_ + 1) - lvl;
+      break;
+    }
+  }
+  return RocksDB_lvl;
 }
 
 void FluidLSM::ScheduleCompaction(DB* db, const std::string& cf_name,
                                   int origin_lvl, int target_lvl,
+                                  int RocksDB_lvl,
                                   std::vector<SstFileMetaData*> input_files) {
-  if (parallel_compactions_allowed_ > parallel_compactions_running_) {
-    int RocksDB_lvl = 1 + target_lvl * (smaller_lvl_runs_count_ + 1);
-    int slot = smaller_lvl_runs_count_;
-
-    for (int lvl = 0; lvl <= smaller_lvl_runs_count_ && target_lvl > origin_lvl;
-         lvl++) {
-      if (lazy_levels_[target_lvl]
-              .runs[smaller_lvl_runs_count_ - lvl]
-              .files_.empty()) {
-        RocksDB_lvl = 1 + target_lvl * (smaller_lvl_runs_count_ + 1) - lvl;
-        slot = smaller_lvl_runs_count_ - lvl;
-        break;
+  std::vector<std::vector<SstFileMetaData*>> moves;
+  SplitTrivialMoves(origin_lvl, RocksDB_lvl, input_files, moves);
+  if (input_files.empty() && moves.empty()) {
+    return;
+  }
+
+  long input_bytes = GetCompactionSize(input_files);
+  std::vector<std::string> input_file_names;
+  for (auto file : input_files) {
+    input_file_names.push_back(file->name);
+    file->being_compacted = true;
+    compacting_files_.insert(file->name);
+  }
+  std::vector<std::vector<std::string>> move_names;
+  std::vector<long> move_bytes;
+  for (auto& group : moves) {
+    move_names.emplace_back();
+    move_bytes.push_back(GetCompactionSize(group));
+    for (auto file : group) {
+      move_names.back().push_back(file->name);
+      file->being_compacted = true;
+      compacting_files_.insert(file->name);
+    }
+  }
+  parallel_compactions_running_++;
+  busy_levels_.insert(origin_lvl);
+  busy_levels_.insert(target_lvl);
+
+  if (debug_mode_) {
+    cerr << "schedule compaction.  origin lvl: " << origin_lvl
+         << "   target lvl: " << target_lvl << " (RocksDB lvl "
+         << RocksDB_lvl << ")"
+         << "   num files: " << input_files.size()
+         << "   bytes: " << input_bytes
+         << "   trivial move batches: " << moves.size()
+         << "   ongoing compactions: " << parallel_compactions_running_
+         << endl;
+  }
+
+  CompactionTask* task = new CompactionTask(
+      db, this, cf_name, input_file_names, RocksDB_lvl, compact_options_,
+      false, debug_mode_, origin_lvl, target_lvl, input_bytes);
+  task->compact_options_.output_file_size_limit = file_size_;
+  task->trivial_moves_ = move_names;
+  task->trivial_move_bytes_ = move_bytes;
+  RunCompaction(task);
+}
+
+void FluidLSM::RunCompaction(CompactionTask* task) {
+  options_.env->Schedule(&FluidLSM::CompactFiles, task);
+}
+
+void FluidLSM::SplitTrivialMoves(
+    int origin_lvl, int RocksDB_lvl, std::vector<SstFileMetaData*>& input_files,
+    std::vector<std::vector<SstFileMetaData*>>& moves) {
+  std::map<std::string, int> level_of;
+  for (auto& run : lazy_levels_[origin_lvl].runs) {
+    for (auto& file : run.files_) {
+      level_of[file.name] = run.RocksDB_level_;
+    }
+  }
+  Run* output_run = GetRunOfRocksDBLevel(RocksDB_lvl);
+  std::set<std::string> input_names;
+  for (auto file : input_files) {
+    input_names.insert(file->name);
+  }
+
+  std::vector<SstFileMetaData*> sorted = input_files;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const SstFileMetaData* a, const SstFileMetaData* b) {
+              return a->smallestkey < b->smallestkey;
+            });
+
+  std::vector<SstFileMetaData*> rewrite;
+  std::map<int, std::vector<SstFileMetaData*>> movable;
+  std::string max_largest;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    SstFileMetaData* file = sorted[i];
+    bool overlaps = (i > 0 && max_largest >= file->smallestkey) ||
+                    (i + 1 < sorted.size() &&
+                     sorted[i + 1]->smallestkey <= file->largestkey);
+    max_largest = i == 0 ? file->largestkey
+                         : std::max(max_largest, file->largestkey);
+    for (size_t j = 0; output_run != nullptr && !overlaps &&
+                       j < output_run->files_.size();
+         j++) {
+      const SstFileMetaData& other = output_run->files_[j];
+      overlaps = !input_names.count(other.name) &&
+                 other.smallestkey <= file->largestkey &&
+                 other.largestkey >= file->smallestkey;
+    }
+
+    auto lvl = level_of.find(file->name);
+    if (overlaps || lvl == level_of.end()) {
+      rewrite.push_back(file);
+    } else if (lvl->second != RocksDB_lvl) {
+      movable[lvl->second].push_back(file);
+    }
+    // a lone file that already sits in the output level stays where it is
+  }
+
+  for (auto& level : movable) {
+    for (size_t i = 0; i < level.second.size();
+         i += Default::MAX_MULTI_TRIVIAL_MOVE) {
+      size_t end = std::min(level.second.size(),
+                            i + Default::MAX_MULTI_TRIVIAL_MOVE);
+      moves.emplace_back(level.second.begin() + i, level.second.begin() + end);
+    }
+  }
+  input_files = rewrite;
+}
+
+bool FluidLSM::PickPartialSlice(int lvl, PartialRound& round,
+                                std::vector<SstFileMetaData*>& input_files,
+                                std::string* largest_key) {
+  std::vector<SstFileMetaData*> files;
+  for (auto& run : lazy_levels_[lvl].runs) {
+    for (auto& file : run.files_) {
+      files.push_back(&file);
+    }
+  }
+  std::sort(files.begin(), files.end(),
+            [](const SstFileMetaData* a, const SstFileMetaData* b) {
+              return a->smallestkey < b->smallestkey;
+            });
+
+  size_t first = 0;
+  while (first < files.size() &&
+         (files[first]->being_compacted ||
+          (round.has_cursor && files[first]->smallestkey <= round.cursor))) {
+    first++;
+  }
+  if (first == files.size()) {
+    return false;
+  }
+
+  std::vector<bool> taken(files.size(), false);
+  std::string lo = files[first]->smallestkey;
+  std::string hi = files[first]->largestkey;
+  long size_in_bytes = 0;
+
+  while (true) {
+    // close the range over every file of the level that overlaps it
+    for (bool grew = true; grew;) {
+      grew = false;
+      for (size_t i = 0; i < files.size(); i++) {
+        if (taken[i] || files[i]->largestkey < lo ||
+            files[i]->smallestkey > hi) {
+          continue;
+        }
+        if (files[i]->being_compacted) {
+          return false;
+        }
+        taken[i] = true;
+        size_in_bytes += files[i]->size;
+        lo = std::min(lo, files[i]->smallestkey);
+        hi = std::max(hi, files[i]->largestkey);
+        grew = true;
       }
     }
-    target_lvl = std::min(options_.num_levels - 1, target_lvl);
-    int largest_lvl = GetLargestOccupiedLevel();
 
-    std::vector<std::string> input_file_names;
-    for (auto file : input_files) {
-      input_file_names.push_back(file->name);
-      file->being_compacted = true;
+    if (size_in_bytes >= partial_compaction_bytes_) {
+      break;
+    }
+    size_t next = 0;
+    while (next < files.size() &&
+           (taken[next] || files[next]->smallestkey <= hi)) {
+      next++;
+    }
+    if (next == files.size()) {
+      break;
+    }
+    hi = std::max(hi, files[next]->largestkey);
+  }
+
+  for (size_t i = 0; i < files.size(); i++) {
+    if (taken[i]) {
+      input_files.push_back(files[i]);
+    }
+  }
+
+  // earlier slices of the round already sit in the output level, merge the
+  // ones this slice overlaps so the level stays one sorted run
+  Run* output_run = GetRunOfRocksDBLevel(round.output_lvl);
+  if (output_run != nullptr && round.target_lvl != lvl) {
+    for (auto& file : output_run->files_) {
+      if (file.largestkey < lo || file.smallestkey > hi) {
+        continue;
+      }
+      if (file.being_compacted) {
+        return false;
+      }
+      input_files.push_back(&file);
+    }
+  }
+
+  *largest_key = hi;
+  return true;
+}
+
+int FluidLSM::GetRunLimit(int lvl, int largest_lvl) const {
+  return lvl < largest_lvl ? smaller_lvl_runs_count_ : larger_lvl_runs_count_;
+}
+
+void FluidLSM::DispatchCompactions(DB* db, const std::string& cf_name) {
+  std::vector<PendingCompaction> deferred;
+
+  while (parallel_compactions_running_ < parallel_compactions_allowed_ &&
+         !pending_compactions_.empty()) {
+    PendingCompaction next = pending_compactions_.top();
+    pending_compactions_.pop();
+
+    if (busy_levels_.count(next.lvl)) {
+      deferred.push_back(next);
+      continue;
     }
-    parallel_compactions_mutex_.lock();
-    parallel_compactions_running_++;
-    parallel_compactions_mutex_.unlock();
-
-    CompactionTask* task =
-        new CompactionTask(db, this, cf_name, input_file_names, RocksDB_lvl,
-                           compact_options_, false, debug_mode_);
-    task->compact_options_.output_file_size_limit = file_size_;
-    options_.env->Schedule(&FluidLSM::CompactFiles, task);
-  } else if (debug_mode_) {
-    cerr << "skip compaction.  origin lvl: " << origin_lvl
-         << "   num files: " << input_files.size();
-    cerr << "   ongoing compactions: " << parallel_compactions_running_ << endl;
-    int runs = lazy_levels_[origin_lvl].runs.size();
-    int live_runs = lazy_levels_[origin_lvl].NumLiveRuns();
-    cerr << "runs " << runs
-         << "    live runs:  " << lazy_levels_[origin_lvl].NumLiveRuns()
+
+    PartialRound& round = partial_rounds_[next.lvl];
+    std::vector<SstFileMetaData*> input_files;
+    int target_lvl = round.target_lvl;
+    if (!round.active) {
+      AddFilesToCompaction(db, next.lvl, input_files);
+      if (input_files.empty()) {
+        continue;
+      }
+      target_lvl = std::min((int)lazy_levels_.size() - 1,
+                            GetCompactionTargetLevel(next.lvl, input_files));
+      if (requested_levels_.count(next.lvl)) {
+        target_lvl = std::max(
+            target_lvl, std::min(next.lvl + 1, GetLargestOccupiedLevel()));
+      }
+    }
+    if (busy_levels_.count(target_lvl)) {
+      deferred.push_back(next);
+      continue;
+    }
+
+    requested_levels_.erase(next.lvl);
+    if (partial_compaction_bytes_ <= 0) {
+      ScheduleCompaction(db, cf_name, next.lvl, target_lvl,
+                         GetTargetSlot(next.lvl, target_lvl), input_files);
+      continue;
+    }
+
+    bool fresh_round = !round.active;
+    if (fresh_round) {
+      // every slice of the round lands in the slot picked here
+      round.active = true;
+      round.target_lvl = target_lvl;
+      round.output_lvl = GetTargetSlot(next.lvl, target_lvl);
+      round.has_cursor = false;
+    }
+
+    input_files.clear();
+    std::string largest_key;
+    if (!PickPartialSlice(next.lvl, round, input_files, &largest_key)) {
+      round.active = false;
+      // files that arrived behind the cursor start the next round
+      if (!fresh_round) {
+        pending_compactions_.push(next);
+      }
+      continue;
+    }
+
+    round.cursor = largest_key;
+    round.has_cursor = true;
+    ScheduleCompaction(db, cf_name, next.lvl, target_lvl, round.output_lvl,
+                       input_files);
+  }
+
+  for (auto& pending : deferred) {
+    pending_compactions_.push(pending);
+  }
+
+  if (debug_mode_ && !pending_compactions_.empty()) {
+    cerr << "queued compactions: " << pending_compactions_.size()
+         << "   ongoing compactions: " << parallel_compactions_running_
+         << "   top lvl: " << pending_compactions_.top().lvl
+         << " (over by " << pending_compactions_.top().overshoot << ")"
          << endl;
   }
 }
 
 void FluidLSM::PickCompaction(DB* db, const std::string& cf_name) {
-  BuildStructure(db);
+  std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+  // running compactions write to RocksDB levels of the old mapping
+  if (has_pending_tuning_ && parallel_compactions_running_ == 0) {
+    if (debug_mode_) {
+      cerr << "FluidLSM retuned from T=" << size_ratio_
+           << " K=" << smaller_lvl_runs_count_
+           << " Z=" << larger_lvl_runs_count_ << " to T=" << pending_size_ratio_
+           << " K=" << pending_smaller_lvl_runs_count_
+           << " Z=" << pending_larger_lvl_runs_count_ << endl;
+    }
+    size_ratio_ = pending_size_ratio_;
+    smaller_lvl_runs_count_ = pending_smaller_lvl_runs_count_;
+    larger_lvl_runs_count_ = pending_larger_lvl_runs_count_;
+    has_pending_tuning_ = false;
+    view_valid_ = false;
+    // slots of running rounds belong to the old level mapping
+    partial_rounds_.assign(partial_rounds_.size(), PartialRound());
+  }
+
+  if (!view_valid_ || ++picks_since_check_ >= kConsistencyCheckInterval) {
+    VerifyStructureLocked(db);
+  }
 
   if (debug_mode_) {
     PrintFluidLSM(db);
   }
 
-  std::vector<SstFileMetaData*> input_files;
+  // the queue is rebuilt from the current shape, so a level that was over
+  // its limit while all slots were taken is picked up again here
+  pending_compactions_ = std::priority_queue<PendingCompaction>();
   int largest_lvl = GetLargestOccupiedLevel();
-  int origin_lvl = 0;
 
   for (int lvl = largest_lvl; lvl >= 0; lvl--) {
-    int num_live_runs = lazy_levels_[lvl].NumLiveRuns();
-    origin_lvl = lvl;
+    int overshoot =
+        lazy_levels_[lvl].NumLiveRuns() - GetRunLimit(lvl, largest_lvl);
+    if (overshoot > 0) {
+      pending_compactions_.push({overshoot, lvl});
+    } else if (requested_levels_.count(lvl) &&
+               lazy_levels_[lvl].NumLiveRuns() > 0) {
+      // requested levels queue behind the ones over their run limit
+      pending_compactions_.push({1, lvl});
+    }
+  }
 
-    if ((lvl < largest_lvl && num_live_runs > smaller_lvl_runs_count_) ||
-        (lvl == largest_lvl && num_live_runs > larger_lvl_runs_count_)) {
-      AddFilesToCompaction(db, lvl, input_files);
-      int target_lvl = GetCompactionTargetLevel(origin_lvl, input_files);
-      ScheduleCompaction(db, cf_name, origin_lvl, target_lvl, input_files);
-      input_files.clear();
+  DispatchCompactions(db, cf_name);
+}
+
+void FluidLSM::RequestCompaction(DB* db, int RocksDB_lvl) {
+  {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    int lvl = RocksDB_lvl == 0
+                  ? 0
+                  : (RocksDB_lvl - 1 + smaller_lvl_runs_count_) /
+                        (smaller_lvl_runs_count_ + 1);
+    if (lvl >= (int)lazy_levels_.size()) {
+      return;
     }
+    requested_levels_.insert(lvl);
   }
+  PickCompaction(db, kDefaultColumnFamilyName);
 }
 
 void FluidLSM::OnFlushCompleted(DB* db, const FlushJobInfo& info) {
+  {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    if (view_valid_ && !info.file_path.empty()) {
+      view_valid_ = AddFileToView(
+          MakeFileMetaData(info.file_path, &info.table_properties), 0);
+    }
+  }
   PickCompaction(db, info.cf_name);
 }
 
-}  // namespace ROCKSDB_NAMESPACE
\ No newline at end of file
+void FluidLSM::OnCompactionCompleted(DB* /*db*/, const CompactionJobInfo& ci) {
+  std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+  std::vector<std::string> input_file_names;
+  for (auto& path : ci.input_files) {
+    input_file_names.push_back(FileName(path));
+  }
+
+  if (!ci.status.ok()) {
+    ReleaseFiles(input_file_names);
+    return;
+  }
+  if (!view_valid_) {
+    return;
+  }
+
+  bool applied = ci.input_files.size() == ci.input_file_infos.size();
+  std::map<int, std::set<std::string>> inputs_by_level;
+  for (size_t i = 0; applied && i < input_file_names.size(); i++) {
+    compacting_files_.erase(input_file_names[i]);
+    inputs_by_level[ci.input_file_infos[i].level].insert(input_file_names[i]);
+  }
+  for (auto& level : inputs_by_level) {
+    applied = applied && RemoveFilesFromView(level.second, level.first);
+  }
+
+  for (size_t i = 0; applied && i < ci.output_files.size(); i++) {
+    auto props = ci.table_properties.find(ci.output_files[i]);
+    applied = AddFileToView(
+        MakeFileMetaData(ci.output_files[i],
+                         props == ci.table_properties.end()
+                             ? nullptr
+                             : props->second.get()),
+        ci.output_level);
+  }
+
+  view_valid_ = applied;
+}
+
+std::string FluidLSM::CompactionReport() {
+  std::ostringstream report;
+  {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    report << "[FluidLSM] mode="
+           << (partial_compaction_bytes_ > 0 ? "partial" : "full")
+           << " compactions=" << compaction_bytes_.Count() << " input_bytes("
+           << compaction_bytes_.ToString() << ") duration_ns("
+           << compaction_durations_.ToString() << ")"
+           << " trivial_moves=" << trivial_moves_
+           << " trivial_move_bytes=" << trivial_move_bytes_
+           << " rewritten_moves=" << rewritten_moves_
+           << " rewritten_move_bytes=" << rewritten_move_bytes_;
+  }
+  report << " foreground_during_compaction("
+         << foreground_during_compaction_.ToString()
+         << ") foreground_idle(" << foreground_idle_.ToString() << ")";
+  return report.str();
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,152 @@
+#include "fluid_tuner.h"
+
+#include <cmath>
+#include <fstream>
+
+#include "fluid_lsm.h"
+
+FluidTuner::FluidTuner(std::unique_ptr<DBEnv> &env,
+                       std::shared_ptr<Buffer> &buffer)
+    : buffer_(buffer),
+      entry_size_(env->entry_size),
+      entries_per_page_(env->entries_per_page),
+      buffer_size_(env->GetBufferSize()),
+      bits_per_key_(env->bits_per_key),
+      scan_selectivity_(env->range_query_selectivity),
+      num_levels_(env->num_levels),
+      interval_(std::max(env->fluid_tune_interval, 1L)) {}
+
+bool FluidTuner::ScanWorkload(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: Failed to read workload from " << path << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      break;
+    }
+    mix_[static_cast<uint8_t>(OpTypeFromCode(line[0]))]++;
+    inserts_scanned_ += line[0] == 'I';
+  }
+  return true;
+}
+
+int FluidTuner::NumLevels(int size_ratio, double num_entries) const {
+  double buffers = num_entries * entry_size_ / buffer_size_;
+  if (buffers <= 1) {
+    return 1;
+  }
+  return std::max(1, (int)std::ceil(std::log(buffers) / std::log(size_ratio)));
+}
+
+bool FluidTuner::Fits(const FluidSetting &setting, double num_entries) const {
+  // the largest lazy level must map onto an existing RocksDB level
+  int levels = NumLevels(setting.size_ratio, num_entries);
+  return 1 + levels * (setting.smaller_lvl_runs_count + 1) < num_levels_;
+}
+
+double FluidTuner::EstimateCost(const FluidSetting &setting,
+                                double num_entries) const {
+  double T = setting.size_ratio;
+  double K = setting.smaller_lvl_runs_count;
+  double Z = setting.larger_lvl_runs_count;
+  double L = NumLevels(setting.size_ratio, num_entries);
+  double fpr = std::exp(-bits_per_key_ * std::log(2) * std::log(2));
+  double runs = K * (L - 1) + Z;
+
+  double write = ((T - 1) / (K + 1) * (L - 1) + (T - 1) / (Z + 1)) /
+                 entries_per_page_;
+  double lookup = 1 + fpr * runs;
+  double scan = runs + scan_selectivity_ * num_entries / entries_per_page_ *
+                           (Z + 1 / T);
+
+  double writes = mix_[(int)OpType::kInsert] + mix_[(int)OpType::kUpdate] +
+                  mix_[(int)OpType::kDelete];
+  double lookups = mix_[(int)OpType::kPointQuery];
+  double scans = mix_[(int)OpType::kRangeQuery];
+  double total = std::max(writes + lookups + scans, 1.0);
+
+  return (writes * write + lookups * lookup + scans * scan) / total;
+}
+
+FluidSetting FluidTuner::Recommend(double num_entries) const {
+  FluidSetting best = {2, 1, 1};
+  double best_cost = -1;
+
+  for (int T = 2; T <= kMaxSizeRatio; T++) {
+    for (int K = 1; K < T; K++) {
+      for (int Z = 1; Z < T; Z++) {
+        FluidSetting setting = {T, K, Z};
+        if (!Fits(setting, num_entries)) {
+          continue;
+        }
+        double cost = EstimateCost(setting, num_entries);
+        if (best_cost < 0 || cost < best_cost) {
+          best = setting;
+          best_cost = cost;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+void FluidTuner::PrintRecommendation(const FluidSetting &current,
+                                     double num_entries) {
+  if (num_entries <= 0) {
+    num_entries = inserts_scanned_;
+  }
+  FluidSetting best = Recommend(num_entries);
+
+  (*buffer_) << "[FluidTuner] ops(I/U/D/Q/S)="
+             << (uint64_t)mix_[(int)OpType::kInsert] << "/"
+             << (uint64_t)mix_[(int)OpType::kUpdate] << "/"
+             << (uint64_t)mix_[(int)OpType::kDelete] << "/"
+             << (uint64_t)mix_[(int)OpType::kPointQuery] << "/"
+             << (uint64_t)mix_[(int)OpType::kRangeQuery]
+             << " entries=" << (uint64_t)num_entries
+             << " current T=" << current.size_ratio
+             << " K=" << current.smaller_lvl_runs_count
+             << " Z=" << current.larger_lvl_runs_count
+             << " cost=" << EstimateCost(current, num_entries)
+             << " best T=" << best.size_ratio
+             << " K=" << best.smaller_lvl_runs_count
+             << " Z=" << best.larger_lvl_runs_count
+             << " cost=" << EstimateCost(best, num_entries) << std::endl;
+}
+
+void FluidTuner::MaybeRetune(DB *db, FluidLSM *tree) {
+  if (ops_since_tune_ < interval_) {
+    return;
+  }
+  ops_since_tune_ = 0;
+  for (size_t i = 0; i < mix_.size(); i++) {
+    mix_[i] = mix_[i] * kMixDecay + op_counts_[i];
+    op_counts_[i] = 0;
+  }
+
+  uint64_t num_entries = 0;
+  db->GetIntProperty("rocksdb.estimate-num-keys", &num_entries);
+  if (num_entries == 0) {
+    return;
+  }
+
+  FluidSetting current = {tree->GetSizeRatio(),
+                          tree->GetSmallerLevelRunsCount(),
+                          tree->GetLargerLevelRunsCount()};
+  FluidSetting best = Recommend(num_entries);
+  double current_cost = EstimateCost(current, num_entries);
+  double best_cost = EstimateCost(best, num_entries);
+  if (current_cost <= 0 ||
+      (current_cost - best_cost) / current_cost < kMinGain) {
+    return;
+  }
+
+  PrintRecommendation(current, num_entries);
+  tree->SetPendingTuning(best.size_ratio, best.smaller_lvl_runs_count,
+                         best.larger_lvl_runs_count);
+}
@@ -0,0 +1,66 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+LatencyHistogram::LatencyHistogram() : buckets_(kNumBuckets, 0) { Reset(); }
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+  min_ = std::min(min_, other.min_);
+}
+
+void LatencyHistogram::Reset() {
+  std::fill(buckets_.begin(), buckets_.end(), 0);
+  count_ = 0;
+  sum_ = 0;
+  max_ = 0;
+  min_ = std::numeric_limits<uint64_t>::max();
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t bucket) {
+  if (bucket < kSubBuckets)
+    return bucket;
+  size_t shift = bucket / kSubBuckets - 1;
+  uint64_t sub = bucket % kSubBuckets + kSubBuckets;
+  return ((sub + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+  if (count_ == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(p / 100.0 * count_ + 0.5);
+  rank = std::max<uint64_t>(1, std::min(rank, count_));
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      // the bucket bound can overshoot the largest recorded sample
+      return std::min(std::max(BucketUpperBound(i), min_), max_);
+    }
+  }
+  return max_;
+}
+
+uint64_t LatencyHistogram::CountAtLeast(uint64_t value) const {
+  uint64_t count = 0;
+  for (size_t i = BucketFor(value); i < kNumBuckets; i++) {
+    count += buckets_[i];
+  }
+  return count;
+}
+
+std::string LatencyHistogram::ToString() const {
+  std::stringstream ss;
+  ss << "count=" << count_ << " avg=" << (uint64_t)Mean()
+     << " p50=" << Percentile(50) << " p99=" << Percentile(99)
+     << " p99.9=" << Percentile(99.9) << " max=" << Max();
+  return ss.str();
+}
@@ -0,0 +1,31 @@
+/*
+ * Prints logs written by working_version to stdout, decompressing the ones
+ * written with --compress_logs, e.g. `log_cat stats.log.zst | grep GetTime`.
+ */
+#include <cstdio>
+#include <iostream>
+
+#include "log_reader.h"
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <log file>..." << std::endl;
+    return 1;
+  }
+  int rc = 0;
+  char chunk[1 << 16];
+  for (int i = 1; i < argc; i++) {
+    LogReader reader;
+    if (!reader.Open(argv[i])) {
+      rc = 1;
+      continue;
+    }
+    size_t n;
+    while ((n = reader.Read(chunk, sizeof(chunk))) > 0) {
+      if (fwrite(chunk, 1, n, stdout) != n) {
+        return 1;
+      }
+    }
+  }
+  return rc;
+}
@@ -0,0 +1,120 @@
+#include "log_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef LOG_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+const unsigned char kZstdMagic[4] = {0x28, 0xB5, 0x2F, 0xFD};
+const size_t kChunkSize = 1 << 17;
+} // namespace
+
+LogReader::~LogReader() {
+#ifdef LOG_ZSTD
+  ZSTD_freeDCtx(static_cast<ZSTD_DCtx *>(dctx_));
+#endif // LOG_ZSTD
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool LogReader::Open(const std::string &path) {
+  file_ = fopen(path.c_str(), "rb");
+  if (!file_) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: cannot open " << path << std::endl;
+    return false;
+  }
+  in_.resize(kChunkSize);
+  out_.resize(kChunkSize);
+  in_size_ = fread(in_.data(), 1, in_.size(), file_);
+
+  if (in_size_ >= sizeof(kZstdMagic) &&
+      memcmp(in_.data(), kZstdMagic, sizeof(kZstdMagic)) == 0) {
+#ifdef LOG_ZSTD
+    dctx_ = ZSTD_createDCtx();
+#else
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: " << path << " is zstd compressed, rebuild with "
+              << "-DWITH_ZSTD=ON to read it" << std::endl;
+    return false;
+#endif // LOG_ZSTD
+  }
+  return true;
+}
+
+// decodes the next chunk into out_, false once the input is used up
+bool LogReader::Fill() {
+  out_pos_ = out_size_ = 0;
+  while (out_size_ == 0) {
+    if (in_pos_ == in_size_ && !eof_) {
+      in_pos_ = 0;
+      in_size_ = fread(in_.data(), 1, in_.size(), file_);
+      eof_ = in_size_ == 0;
+    }
+    // with the input gone, zstd is drained once a call leaves room in out_
+    if (in_pos_ == in_size_ && eof_ && !zstd_pending_) {
+      return false;
+    }
+    if (!dctx_) {
+      std::swap(in_, out_);
+      out_size_ = in_size_;
+      in_pos_ = in_size_ = 0;
+      in_.resize(kChunkSize);
+      continue;
+    }
+#ifdef LOG_ZSTD
+    ZSTD_inBuffer input = {in_.data(), in_size_, in_pos_};
+    ZSTD_outBuffer output = {out_.data(), out_.size(), 0};
+    size_t ret = ZSTD_decompressStream(static_cast<ZSTD_DCtx *>(dctx_),
+                                       &output, &input);
+    if (ZSTD_isError(ret)) {
+      std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                << "]: zstd: " << ZSTD_getErrorName(ret) << std::endl;
+      eof_ = true;
+      in_pos_ = in_size_;
+      zstd_pending_ = false;
+      return false;
+    }
+    in_pos_ = input.pos;
+    out_size_ = output.pos;
+    zstd_pending_ = output.pos == output.size;
+#endif // LOG_ZSTD
+  }
+  return true;
+}
+
+size_t LogReader::Read(char *out, size_t len) {
+  if (out_pos_ == out_size_ && !Fill()) {
+    return 0;
+  }
+  size_t n = std::min(len, out_size_ - out_pos_);
+  memcpy(out, out_.data() + out_pos_, n);
+  out_pos_ += n;
+  return n;
+}
+
+bool LogReader::ReadLine(std::string *line) {
+  line->clear();
+  while (true) {
+    if (out_pos_ == out_size_ && !Fill()) {
+      // a killed run may leave a last line without newline
+      return !line->empty();
+    }
+    const char *begin = out_.data() + out_pos_;
+    const char *end = out_.data() + out_size_;
+    const char *newline =
+        static_cast<const char *>(memchr(begin, '\n', end - begin));
+    if (newline) {
+      line->append(begin, newline - begin);
+      out_pos_ += newline - begin + 1;
+      return true;
+    }
+    line->append(begin, end - begin);
+    out_pos_ = out_size_;
+  }
+}
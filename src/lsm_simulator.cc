@@ -0,0 +1,570 @@
+#include "lsm_simulator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <set>
+
+#include "fluid_lsm.h"
+
+namespace {
+const long double kKeySpace =
+    (long double)std::numeric_limits<uint64_t>::max() + 1;
+
+// fixed width hex keeps the string order of keys equal to their value order
+std::string EncodeKey(uint64_t key) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016" PRIx64, key);
+  return std::string(buf, 16);
+}
+
+uint64_t DecodeKey(const std::string &key) {
+  return strtoull(key.c_str(), nullptr, 16);
+}
+
+long double KeyRangeWidth(uint64_t smallest, uint64_t largest) {
+  return (long double)(largest - smallest) + 1;
+}
+} // namespace
+
+/**
+ * FluidLSM with its DB-facing parts left out: the simulator keeps the lazy
+ * level view as the only copy of the tree, and FluidLSM's own picker and
+ * dispatcher hand it the compactions to run instead of the LOW pool
+ */
+class SimulatedFluidLSM : public FluidLSM {
+public:
+  SimulatedFluidLSM(int size_ratio, int smaller_lvl_runs_count,
+                    int larger_lvl_runs_count, long file_size,
+                    const Options &options)
+      : FluidLSM(size_ratio, smaller_lvl_runs_count, larger_lvl_runs_count,
+                 file_size, options) {
+    ColumnFamilyMetaData cf_meta;
+    for (int lvl = 0; lvl < options.num_levels; lvl++) {
+      cf_meta.levels.emplace_back(lvl, 0, std::vector<SstFileMetaData>());
+    }
+    BuildStructureFromMetadata(cf_meta);
+    view_valid_ = true;
+  }
+
+  void AddFlushedFile(const SstFileMetaData &file) {
+    {
+      std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+      AddFileToView(file, 0);
+    }
+    Pick();
+  }
+
+  /**
+   * Next compaction FluidLSM scheduled, nullptr once it has none
+   */
+  std::unique_ptr<CompactionTask> NextTask() {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    if (tasks_.empty()) {
+      return nullptr;
+    }
+    std::unique_ptr<CompactionTask> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    return task;
+  }
+
+  /**
+   * Takes the files the task rewrites out of the view. Like RocksDB's
+   * CompactFiles, the files of the output level overlapping the inputs
+   * join the compaction.
+   */
+  std::vector<SstFileMetaData> TakeInputs(CompactionTask &task,
+                                          bool *bottommost) {
+    std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+    std::set<std::string> names(task.input_file_names_.begin(),
+                                task.input_file_names_.end());
+    std::vector<SstFileMetaData> inputs;
+    std::map<int, std::set<std::string>> inputs_by_level;
+    std::string lo, hi;
+    // inputs come from the origin level, and from the output run of the
+    // target level for the slices of a partial round
+    for (int lvl :
+         std::set<int>{task.origin_lazy_lvl_, task.target_lazy_lvl_}) {
+      for (auto &run : lazy_levels_[lvl].runs) {
+        for (auto &file : run.files_) {
+          if (!names.count(file.name)) {
+            continue;
+          }
+          inputs.push_back(file);
+          inputs_by_level[run.RocksDB_level_].insert(file.name);
+          lo = lo.empty() ? file.smallestkey : std::min(lo, file.smallestkey);
+          hi = std::max(hi, file.largestkey);
+        }
+      }
+    }
+    Run *output_run = GetRunOfRocksDBLevel(task.output_lvl_);
+    for (size_t i = 0; output_run != nullptr && !inputs.empty() &&
+                       i < output_run->files_.size();
+         i++) {
+      SstFileMetaData &file = output_run->files_[i];
+      if (!names.count(file.name) && file.smallestkey <= hi &&
+          file.largestkey >= lo) {
+        inputs.push_back(file);
+        inputs_by_level[task.output_lvl_].insert(file.name);
+      }
+    }
+    for (auto &level : inputs_by_level) {
+      RemoveFilesFromView(level.second, level.first);
+      for (auto &name : level.second) {
+        compacting_files_.erase(name);
+      }
+    }
+
+    *bottommost = true;
+    for (auto &lazy_level : lazy_levels_) {
+      for (auto &run : lazy_level.runs) {
+        if (run.RocksDB_level_ > task.output_lvl_ && !run.files_.empty()) {
+          *bottommost = false;
+        }
+      }
+    }
+    return inputs;
+  }
+
+  /**
+   * Installs the outputs and lets FluidLSM pick the next compactions, as
+   * CompactFiles and the compaction listener do on a real DB
+   */
+  void FinishTask(std::unique_ptr<CompactionTask> task,
+                  std::vector<SstFileMetaData> const &outputs) {
+    {
+      std::lock_guard<std::mutex> lock(lazy_levels_mutex_);
+      for (auto &file : outputs) {
+        AddFileToView(file, task->output_lvl_);
+      }
+      // a metadata-only model always honors the trivial moves
+      std::vector<size_t> moved_groups;
+      for (size_t i = 0; i < task->trivial_moves_.size(); i++) {
+        moved_groups.push_back(i);
+      }
+      FinishCompactionLocked(task.get(), true, 0, moved_groups, {});
+    }
+    Pick();
+  }
+
+  const std::vector<LazyLevel>& GetLazyLevels() const { return lazy_levels_; }
+
+protected:
+  void Pick() {
+    // the view is the tree, the periodic rebuild from metadata finds nothing
+    picks_since_check_ = 0;
+    PickCompaction(nullptr, kDefaultColumnFamilyName);
+  }
+
+  // the view is the tree, there is nothing else to rebuild it from
+  void GetMetadata(DB * /*db*/, ColumnFamilyMetaData *cf_meta) override {
+    for (int lvl = 0; lvl < options_.num_levels; lvl++) {
+      cf_meta->levels.emplace_back(lvl, 0, std::vector<SstFileMetaData>());
+    }
+    for (auto &lazy_level : lazy_levels_) {
+      for (auto &run : lazy_level.runs) {
+        auto &files = cf_meta->levels[run.RocksDB_level_].files;
+        files.insert(files.end(), run.files_.begin(), run.files_.end());
+      }
+    }
+  }
+
+  void RunCompaction(CompactionTask *task) override {
+    tasks_.emplace_back(task);
+  }
+
+private:
+  std::deque<std::unique_ptr<CompactionTask>> tasks_;
+};
+
+LSMSimulator::LSMSimulator(std::unique_ptr<DBEnv> &env)
+    : fluid_(env->enable_fluid_lsm),
+      sequential_(env->simulate_sequential),
+      round_robin_(env->compaction_pri == 5),
+      num_levels_(env->num_levels),
+      level0_trigger_(std::max(env->level0_file_num_compaction_trigger, 1)),
+      size_ratio_(env->size_ratio),
+      entry_size_(env->entry_size),
+      bits_per_key_(env->bits_per_key),
+      update_fraction_(0),
+      buffer_entries_(std::max<uint64_t>(
+          env->GetBufferSize() / env->entry_size, 1)),
+      file_size_(env->GetTargetFileSizeBase()),
+      max_bytes_for_level_base_(env->GetMaxBytesForLevelBase()),
+      levels_(env->num_levels),
+      round_robin_cursor_(env->num_levels, 0) {
+  if (env->num_inserts + env->num_updates > 0) {
+    update_fraction_ =
+        (double)env->num_updates / (env->num_inserts + env->num_updates);
+  }
+
+  if (fluid_) {
+    Options options;
+    options.num_levels = env->num_levels;
+    options.write_buffer_size = env->GetBufferSize();
+    options.target_file_size_base = file_size_;
+    fluid_tree_ = std::make_unique<SimulatedFluidLSM>(
+        env->size_ratio, env->smaller_lvl_runs_count,
+        env->larger_lvl_runs_count, file_size_, options);
+    fluid_tree_->SetPartialCompactions(env->partial_compaction_bytes);
+  }
+}
+
+LSMSimulator::~LSMSimulator() = default;
+
+SstFileMetaData LSMSimulator::NewFile(uint64_t smallest, uint64_t largest,
+                                      uint64_t entries) {
+  SstFileMetaData file;
+  file.file_number = next_file_number_++;
+  file.name = "/sim_" + std::to_string(file.file_number) + ".sst";
+  file.smallestkey = EncodeKey(smallest);
+  file.largestkey = EncodeKey(largest);
+  file.num_entries = entries;
+  file.size = entries * entry_size_;
+  return file;
+}
+
+std::vector<SstFileMetaData>
+LSMSimulator::Merge(std::vector<SstFileMetaData> const &inputs,
+                    bool bottommost) {
+  uint64_t lo = std::numeric_limits<uint64_t>::max(), hi = 0;
+  uint64_t sum_entries = 0, max_entries = 0;
+  for (auto &file : inputs) {
+    lo = std::min(lo, DecodeKey(file.smallestkey));
+    hi = std::max(hi, DecodeKey(file.largestkey));
+    sum_entries += file.num_entries;
+    max_entries = std::max<uint64_t>(max_entries, file.num_entries);
+    compaction_read_bytes_ += file.size;
+  }
+
+  // live keys per unit of key space
+  long double density = sequential_ ? 1.0L / sequential_key_step_
+                                    : live_keys_ / kKeySpace;
+  long double live_in_range = density * KeyRangeWidth(lo, hi);
+
+  long double distinct;
+  if (bottommost) {
+    // nothing older below: every obsolete version in range is dropped
+    distinct = live_in_range;
+  } else {
+    // inputs are independent samples of the live keys of their ranges
+    long double missed = 1;
+    for (auto &file : inputs) {
+      long double file_live =
+          density * KeyRangeWidth(DecodeKey(file.smallestkey),
+                                  DecodeKey(file.largestkey));
+      missed *= 1 - std::min<long double>(1, file.num_entries / file_live);
+    }
+    distinct = live_in_range * (1 - missed);
+  }
+  uint64_t entries = std::min<uint64_t>(
+      sum_entries, std::max<uint64_t>((uint64_t)distinct, max_entries));
+
+  uint64_t entries_per_file = std::max<uint64_t>(file_size_ / entry_size_, 1);
+  uint64_t num_files = std::max<uint64_t>(
+      (entries + entries_per_file - 1) / entries_per_file, 1);
+  long double width = KeyRangeWidth(lo, hi) / num_files;
+
+  std::vector<SstFileMetaData> outputs;
+  for (uint64_t i = 0; i < num_files; i++) {
+    uint64_t smallest = lo + (uint64_t)(width * i);
+    uint64_t largest =
+        i + 1 == num_files ? hi : lo + (uint64_t)(width * (i + 1)) - 1;
+    uint64_t file_entries = entries / num_files + (i < entries % num_files);
+    outputs.push_back(NewFile(smallest, largest, file_entries));
+    compaction_write_bytes_ += outputs.back().size;
+  }
+  num_compactions_++;
+  return outputs;
+}
+
+void LSMSimulator::Flush(uint64_t entries) {
+  SstFileMetaData file;
+  if (sequential_) {
+    uint64_t smallest = next_sequential_key_;
+    next_sequential_key_ += entries * sequential_key_step_;
+    file = NewFile(smallest, next_sequential_key_ - 1, entries);
+    live_keys_ += entries;
+  } else {
+    // a buffer of random keys spans (almost) the whole key space
+    file = NewFile(0, std::numeric_limits<uint64_t>::max(), entries);
+    live_keys_ += entries * (1 - update_fraction_);
+  }
+  num_flushes_++;
+  flushed_bytes_ += file.size;
+
+  if (fluid_) {
+    fluid_tree_->AddFlushedFile(file);
+    CompactFluid();
+  } else {
+    levels_[0].insert(levels_[0].begin(), file);
+    CompactLeveled();
+  }
+}
+
+void LSMSimulator::Ingest(uint64_t bytes) {
+  uint64_t total_entries = bytes / entry_size_;
+  if (sequential_ && total_entries > 0) {
+    sequential_key_step_ = std::max<uint64_t>(
+        std::numeric_limits<uint64_t>::max() / total_entries, 1);
+  }
+
+  for (uint64_t done = 0; done < total_entries; done += buffer_entries_) {
+    uint64_t entries = std::min(buffer_entries_, total_entries - done);
+    ingested_bytes_ += entries * entry_size_;
+    Flush(entries);
+  }
+}
+
+uint64_t LSMSimulator::LevelTargetBytes(int level) const {
+  return max_bytes_for_level_base_ * std::pow(size_ratio_, level - 1);
+}
+
+bool LSMSimulator::PickLeveled(int *level, std::vector<size_t> *inputs) {
+  // same scores as RocksDB: L0 by file count, the others by size
+  double best_score = 1;
+  *level = -1;
+  for (int i = 0; i + 1 < num_levels_; i++) {
+    double score;
+    if (i == 0) {
+      score = (double)levels_[0].size() / level0_trigger_;
+    } else {
+      uint64_t bytes = 0;
+      for (auto &file : levels_[i]) {
+        bytes += file.size;
+      }
+      score = (double)bytes / LevelTargetBytes(i);
+    }
+    if (score >= best_score) {
+      best_score = score;
+      *level = i;
+    }
+  }
+  if (*level < 0) {
+    return false;
+  }
+
+  inputs->clear();
+  if (*level == 0) {
+    for (size_t i = 0; i < levels_[0].size(); i++) {
+      inputs->push_back(i);
+    }
+    return true;
+  }
+
+  std::vector<SstFileMetaData> &files = levels_[*level];
+  std::vector<SstFileMetaData> &next = levels_[*level + 1];
+  if (round_robin_) {
+    size_t pick = 0;
+    while (pick < files.size() &&
+           DecodeKey(files[pick].smallestkey) < round_robin_cursor_[*level]) {
+      pick++;
+    }
+    pick = pick == files.size() ? 0 : pick;
+    round_robin_cursor_[*level] = DecodeKey(files[pick].largestkey) + 1;
+    inputs->push_back(pick);
+    return true;
+  }
+
+  // kMinOverlappingRatio: bytes overlapped in the next level per input byte
+  std::vector<uint64_t> prefix(next.size() + 1, 0);
+  for (size_t i = 0; i < next.size(); i++) {
+    prefix[i + 1] = prefix[i] + next[i].size;
+  }
+  size_t pick = 0, first = 0, last = 0;
+  double best_ratio = -1;
+  for (size_t i = 0; i < files.size(); i++) {
+    while (first < next.size() &&
+           next[first].largestkey < files[i].smallestkey) {
+      first++;
+    }
+    last = std::max(last, first);
+    while (last < next.size() &&
+           next[last].smallestkey <= files[i].largestkey) {
+      last++;
+    }
+    double ratio = (double)(prefix[last] - prefix[first]) / files[i].size;
+    if (best_ratio < 0 || ratio < best_ratio) {
+      best_ratio = ratio;
+      pick = i;
+    }
+  }
+  inputs->push_back(pick);
+  return true;
+}
+
+void LSMSimulator::CompactLeveled() {
+  int level;
+  std::vector<size_t> picked;
+  while (PickLeveled(&level, &picked)) {
+    std::vector<SstFileMetaData> inputs;
+    std::string lo, hi;
+    for (size_t i : picked) {
+      inputs.push_back(levels_[level][i]);
+      lo = lo.empty() ? inputs.back().smallestkey
+                      : std::min(lo, inputs.back().smallestkey);
+      hi = std::max(hi, inputs.back().largestkey);
+    }
+    for (auto it = picked.rbegin(); it != picked.rend(); ++it) {
+      levels_[level].erase(levels_[level].begin() + *it);
+    }
+
+    // overlapping files of the output level join the compaction
+    std::vector<SstFileMetaData> &next = levels_[level + 1];
+    auto first = std::lower_bound(
+        next.begin(), next.end(), lo,
+        [](const SstFileMetaData &file, const std::string &key) {
+          return file.largestkey < key;
+        });
+    auto last = first;
+    while (last != next.end() && last->smallestkey <= hi) {
+      inputs.push_back(*last);
+      ++last;
+    }
+    size_t insert_at = first - next.begin();
+    next.erase(first, last);
+
+    bool bottommost = true;
+    for (int i = level + 2; i < num_levels_; i++) {
+      bottommost &= levels_[i].empty();
+    }
+    std::vector<SstFileMetaData> outputs = Merge(inputs, bottommost);
+    next.insert(next.begin() + insert_at, outputs.begin(), outputs.end());
+  }
+}
+
+void LSMSimulator::CompactFluid() {
+  std::unique_ptr<CompactionTask> task;
+  while ((task = fluid_tree_->NextTask()) != nullptr) {
+    bool bottommost;
+    std::vector<SstFileMetaData> inputs =
+        fluid_tree_->TakeInputs(*task, &bottommost);
+    std::vector<SstFileMetaData> outputs;
+    if (!inputs.empty()) {
+      outputs = Merge(inputs, bottommost);
+    }
+    fluid_tree_->FinishTask(std::move(task), outputs);
+  }
+}
+
+uint64_t LSMSimulator::TreeBytes() const {
+  uint64_t bytes = 0;
+  if (fluid_) {
+    for (auto &lazy_level : fluid_tree_->GetLazyLevels()) {
+      for (auto &run : lazy_level.runs) {
+        for (auto &file : run.files_) {
+          bytes += file.size;
+        }
+      }
+    }
+    return bytes;
+  }
+  for (auto &level : levels_) {
+    for (auto &file : level) {
+      bytes += file.size;
+    }
+  }
+  return bytes;
+}
+
+int LSMSimulator::NumSortedRuns() const {
+  int runs = 0;
+  if (fluid_) {
+    for (auto &lazy_level : fluid_tree_->GetLazyLevels()) {
+      for (auto &run : lazy_level.runs) {
+        runs += !run.files_.empty();
+      }
+    }
+    return runs;
+  }
+  runs = levels_[0].size();
+  for (int i = 1; i < num_levels_; i++) {
+    runs += !levels_[i].empty();
+  }
+  return runs;
+}
+
+void LSMSimulator::Report(std::shared_ptr<Buffer> &buffer) {
+  double live_bytes = live_keys_ * entry_size_;
+  double fpr = std::exp(-bits_per_key_ * std::log(2) * std::log(2));
+  int runs = NumSortedRuns();
+
+  (*buffer) << "[Simulator] mode=" << (fluid_ ? "fluid_lsm" : "leveled")
+            << " keys=" << (sequential_ ? "sequential" : "random")
+            << " ingested_bytes=" << ingested_bytes_
+            << " flushes=" << num_flushes_
+            << " compactions=" << num_compactions_ << std::endl;
+  (*buffer) << "[Simulator] write_amp="
+            << (double)(flushed_bytes_ + compaction_write_bytes_) /
+                   std::max<uint64_t>(ingested_bytes_, 1)
+            << " compaction_read_bytes=" << compaction_read_bytes_
+            << " compaction_write_bytes=" << compaction_write_bytes_
+            << " space_amp=" << TreeBytes() / std::max(live_bytes, 1.0)
+            << std::endl;
+  // one I/O for the hit plus the false positives of every other run
+  (*buffer) << "[Simulator] sorted_runs=" << runs
+            << " zero_result_lookup_io=" << runs * fpr
+            << " point_lookup_io=" << 1 + std::max(runs - 1, 0) * fpr
+            << " short_scan_io=" << runs << std::endl;
+
+  if (fluid_) {
+    (*buffer) << "[Simulator] trivial_moves=" << fluid_tree_->GetTrivialMoves()
+              << " trivial_move_bytes=" << fluid_tree_->GetTrivialMoveBytes()
+              << std::endl;
+    auto &lazy_levels = fluid_tree_->GetLazyLevels();
+    for (size_t lvl = 0; lvl < lazy_levels.size(); lvl++) {
+      for (auto &run : lazy_levels[lvl].runs) {
+        if (run.files_.empty()) {
+          continue;
+        }
+        uint64_t bytes = 0;
+        for (auto &file : run.files_) {
+          bytes += file.size;
+        }
+        (*buffer) << "[Simulator] lazy_level=" << lvl
+                  << " rocksdb_level=" << run.RocksDB_level_
+                  << " files=" << run.files_.size() << " bytes=" << bytes
+                  << std::endl;
+      }
+    }
+    return;
+  }
+
+  for (int i = 0; i < num_levels_; i++) {
+    if (levels_[i].empty()) {
+      continue;
+    }
+    uint64_t bytes = 0;
+    for (auto &file : levels_[i]) {
+      bytes += file.size;
+    }
+    (*buffer) << "[Simulator] level=" << i << " files=" << levels_[i].size()
+              << " bytes=" << bytes << std::endl;
+  }
+}
+
+int runSimulation(std::unique_ptr<DBEnv> &env) {
+  std::shared_ptr<Buffer> buffer =
+      std::make_shared<Buffer>("simulation.log");
+  auto start = std::chrono::steady_clock::now();
+
+  LSMSimulator simulator(env);
+  simulator.Ingest(env->simulate_bytes);
+  simulator.Report(buffer);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  (*buffer) << "[Simulator] elapsed_ms=" << elapsed << std::endl;
+  buffer->flush();
+  std::cout << "Simulation completed in " << elapsed
+            << " ms, see simulation.log" << std::endl;
+  return 0;
+}
@@ -0,0 +1,294 @@
+#include "memtable_switch_controller.h"
+#include "trace_writer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+
+bool MemtableCostModel::Load(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  // same order as `runSampleWorkload` flushes them
+  return skiplist.ReadFromStream(in) && vector.ReadFromStream(in) &&
+         hash_skiplist.ReadFromStream(in);
+}
+
+double MemtableCostModel::EstimateCost(uint16_t rep, double write_fraction,
+                                       double read_fraction,
+                                       double scan_fraction,
+                                       double vector_capacity) const {
+  switch (rep) {
+  case 1: {
+    double capacity = vector_capacity * skiplist.numEntriesRatioToVec;
+    return write_fraction * (skiplist.insertTime +
+                             skiplist.sstFlushTime / std::max(capacity, 1.0)) +
+           read_fraction * skiplist.readTime +
+           scan_fraction * skiplist.scanTime;
+  }
+  case 2: {
+    // the sampled benchmark does not flush a vector, borrow the skiplist
+    // flush cost and add the sort that precedes it
+    double flush = skiplist.sstFlushTime + vector.sortingTime;
+    return write_fraction *
+               (vector.insertTime + flush / std::max(vector_capacity, 1.0)) +
+           read_fraction * (vector.readTime + vector.sortingTime) +
+           scan_fraction * (vector.scanTime + vector.sortingTime);
+  }
+  case 3: {
+    double capacity = vector_capacity * hash_skiplist.numEntriesRatioToVec;
+    return write_fraction *
+               (hash_skiplist.insertTime +
+                hash_skiplist.sstFlushTime / std::max(capacity, 1.0)) +
+           read_fraction * hash_skiplist.readTime +
+           scan_fraction * hash_skiplist.scanTime;
+  }
+  default:
+    return -1;
+  }
+}
+
+MemtableSwitchController::MemtableSwitchController(
+    std::unique_ptr<DBEnv> &env, std::shared_ptr<Buffer> &buffer)
+    : buffer_(buffer),
+      bucket_count_(env->bucket_count),
+      prefix_length_(env->prefix_length),
+      skiplist_height_(env->skiplist_height),
+      skiplist_branching_factor_(env->skiplist_branching_factor),
+      min_gain_(env->adaptive_min_gain),
+      vector_capacity_((double)env->GetBufferSize() / env->entry_size),
+      boundary_reserve_(kBoundaryCheckInterval * env->entry_size),
+      window_(std::max<size_t>(env->adaptive_window_size, 1), 0),
+      current_rep_(env->memtable_factory),
+      next_rep_(env->memtable_factory) {
+  candidates_ = {1, 2};
+  // hash based memtables are only usable when a prefix is configured
+  if (prefix_length_ > 0) {
+    candidates_.push_back(3);
+  }
+}
+
+bool MemtableSwitchController::LoadCostModel(const std::string &path) {
+  if (!model_.Load(path)) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: Failed to read memtable cost model from " << path
+              << std::endl;
+    return false;
+  }
+  if (std::find(candidates_.begin(), candidates_.end(), current_rep_) ==
+      candidates_.end()) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: Memtable factory " << current_rep_
+              << " is not covered by the cost model" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+const char *MemtableSwitchController::RepName(uint16_t rep) {
+  switch (rep) {
+  case 1:
+    return "SkipList";
+  case 2:
+    return "Vector";
+  case 3:
+    return "HashSkipList";
+  case 4:
+    return "HashLinkList";
+  case 5:
+    return "UnsortedVector";
+  case 6:
+    return "AlwaysSortedVector";
+  case 7:
+    return "LinkList";
+  default:
+    return "Unknown";
+  }
+}
+
+void MemtableSwitchController::OnMemTableSealed(const MemTableInfo & /*info*/) {
+  sealed_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MemtableSwitchController::MaybeSwitch(DB *db) {
+  if (sealed_seen_ != sealed_count_.load(std::memory_order_relaxed)) {
+    CloseMemtableLifetime();
+  }
+
+  if (disabled_ || decided_ ||
+      ++ops_since_check_ < kBoundaryCheckInterval) {
+    return;
+  }
+  ops_since_check_ = 0;
+
+  // only decide once the active memtable is about to be sealed, so the
+  // decision uses the freshest op mix and applies to the very next memtable
+  if (db->ShouldMemTableFlushNow(boundary_reserve_)) {
+    Decide(db);
+    decided_ = true;
+  }
+}
+
+void MemtableSwitchController::CloseMemtableLifetime() {
+  sealed_seen_ = sealed_count_.load(std::memory_order_relaxed);
+  double lifetime_latency =
+      lifetime_ops_ == 0 ? 0 : (double)lifetime_latency_ns_ / lifetime_ops_;
+
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (!it->active) {
+      // the memtable that just got sealed was the last one on `from`
+      it->baseline_latency = lifetime_latency;
+      it->active = true;
+      ++it;
+      continue;
+    }
+
+    (*buffer_) << "[MemtableSwitch] realized switch=" << it->id
+               << " from=" << RepName(it->from) << " to=" << RepName(it->to)
+               << " avg_latency_before=" << it->baseline_latency
+               << " avg_latency_after=" << lifetime_latency
+               << " est_gain=" << it->estimated_gain * 100 << "%";
+    if (it->baseline_latency > 0 && lifetime_latency > 0) {
+      (*buffer_) << " realized_gain="
+                 << (it->baseline_latency - lifetime_latency) /
+                        it->baseline_latency * 100
+                 << "%";
+    } else {
+      (*buffer_) << " realized_gain=n/a";
+    }
+    (*buffer_) << std::endl;
+    it = pending_.erase(it);
+  }
+
+  TraceWriter *trace = TraceWriter::Get();
+  if (trace && next_rep_ != current_rep_) {
+    trace->Instant("memtable switch", "memtable",
+                   std::string("\"from\":\"") + RepName(current_rep_) +
+                       "\",\"to\":\"" + RepName(next_rep_) + "\"");
+  }
+  current_rep_ = next_rep_;
+  decided_ = false;
+  ops_since_check_ = 0;
+  lifetime_ops_ = 0;
+  lifetime_latency_ns_ = 0;
+}
+
+void MemtableSwitchController::Decide(DB *db) {
+  if (window_filled_ == 0) {
+    return;
+  }
+  num_decisions_++;
+
+  double total = (double)window_filled_;
+  double writes = (window_counts_[(int)OpType::kInsert] +
+                   window_counts_[(int)OpType::kUpdate] +
+                   window_counts_[(int)OpType::kDelete]) /
+                  total;
+  double reads = window_counts_[(int)OpType::kPointQuery] / total;
+  double scans = window_counts_[(int)OpType::kRangeQuery] / total;
+
+  double current_cost =
+      model_.EstimateCost(current_rep_, writes, reads, scans, vector_capacity_);
+  uint16_t best_rep = current_rep_;
+  double best_cost = current_cost;
+  for (uint16_t rep : candidates_) {
+    double cost = model_.EstimateCost(rep, writes, reads, scans,
+                                      vector_capacity_);
+    if (cost >= 0 && cost < best_cost) {
+      best_rep = rep;
+      best_cost = cost;
+    }
+  }
+
+  double gain =
+      current_cost > 0 ? (current_cost - best_cost) / current_cost : 0;
+  if (best_rep == current_rep_ || gain < min_gain_) {
+    next_rep_ = current_rep_;
+    return;
+  }
+
+  if (cost_tracker_) {
+    cost_tracker_->BeginSwitch(db, RepName(current_rep_), RepName(best_rep));
+  }
+  bool applied = ApplyRep(db, best_rep);
+  if (cost_tracker_) {
+    if (applied) {
+      cost_tracker_->EndApply();
+    } else {
+      cost_tracker_->CancelSwitch();
+    }
+  }
+  (*buffer_) << "[MemtableSwitch] decision=" << num_switches_ + 1
+             << " seal=" << sealed_seen_ + 1 << " window(I/U/D/Q/S)="
+             << window_counts_[(int)OpType::kInsert] << "/"
+             << window_counts_[(int)OpType::kUpdate] << "/"
+             << window_counts_[(int)OpType::kDelete] << "/"
+             << window_counts_[(int)OpType::kPointQuery] << "/"
+             << window_counts_[(int)OpType::kRangeQuery]
+             << " from=" << RepName(current_rep_)
+             << " to=" << RepName(best_rep) << " est_cost_from=" << current_cost
+             << " est_cost_to=" << best_cost << " est_gain=" << gain * 100
+             << "% applied=" << (applied ? 1 : 0) << std::endl;
+  if (!applied) {
+    next_rep_ = current_rep_;
+    return;
+  }
+
+  num_switches_++;
+  next_rep_ = best_rep;
+  pending_.push_back({num_switches_, current_rep_, best_rep, gain, false, 0});
+}
+
+bool MemtableSwitchController::ApplyRep(DB *db, uint16_t rep) {
+  std::unordered_map<std::string, std::string> new_options;
+  switch (rep) {
+  case 1:
+    new_options["memtable_factory"] = "skip_list";
+    // only the hash reps need a prefix extractor, and with one scans and
+    // SST prefix filters would take prefix-seek semantics
+    new_options["prefix_extractor"] = "nullptr";
+    break;
+  case 2:
+    new_options["memtable_factory"] = "vector";
+    new_options["prefix_extractor"] = "nullptr";
+    break;
+  case 3:
+    // same factory configOptions builds for -m 3
+    new_options["memtable_factory"] =
+        "{id=HashSkipListRepFactory;bucket_count=" +
+        std::to_string(bucket_count_) +
+        ";skiplist_height=" + std::to_string(skiplist_height_) +
+        ";branching_factor=" + std::to_string(skiplist_branching_factor_) +
+        "}";
+    new_options["prefix_extractor"] =
+        "rocksdb.FixedPrefix." + std::to_string(prefix_length_);
+    break;
+  default:
+    return false;
+  }
+
+  // upstream RocksDB rejects memtable_factory as immutable
+  Status s = db->SetOptions(new_options);
+  if (!s.ok()) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: Failed to switch memtable to " << RepName(rep) << ": "
+              << s.ToString()
+              << ", adaptive memtable disabled (needs a RocksDB that "
+                 "accepts memtable_factory in SetOptions)"
+              << std::endl;
+    disabled_ = true;
+    return false;
+  }
+  return true;
+}
+
+void MemtableSwitchController::PrintSummary() {
+  (*buffer_) << "[MemtableSwitch] decisions: " << num_decisions_
+             << ", switches: " << num_switches_
+             << ", memtables sealed: " << sealed_seen_
+             << ", final rep: " << RepName(current_rep_)
+             << (disabled_ ? ", disabled: SetOptions failed" : "") << std::endl;
+}
@@ -0,0 +1,169 @@
+#include "monkey_filter_policy.h"
+
+#include <cmath>
+#include <map>
+
+#include <rocksdb/perf_context.h>
+#include <rocksdb/table_properties.h>
+
+namespace {
+const double kLn2Squared = std::log(2) * std::log(2);
+} // namespace
+
+MonkeyFilterPolicy::MonkeyFilterPolicy(
+    const std::vector<double> &entries_per_level, double total_bits,
+    double fallback_bits_per_key)
+    : entries_(entries_per_level),
+      bits_(AllocateBits(entries_per_level, total_bits)) {
+  for (double bits : bits_) {
+    // the builtin policy builds no filter below half a bit per key
+    level_policies_.emplace_back(NewBloomFilterPolicy(bits, false));
+  }
+  fallback_policy_.reset(NewBloomFilterPolicy(fallback_bits_per_key, false));
+  reader_policy_ = fallback_policy_;
+}
+
+FilterBitsBuilder *MonkeyFilterPolicy::GetBuilderWithContext(
+    const FilterBuildingContext &context) const {
+  int level = context.level_at_creation;
+  if (level < 0 || level >= (int)level_policies_.size()) {
+    return fallback_policy_->GetBuilderWithContext(context);
+  }
+  return level_policies_[level]->GetBuilderWithContext(context);
+}
+
+double MonkeyFilterPolicy::FalsePositiveRate(double bits_per_key) {
+  return bits_per_key <= 0 ? 1 : std::exp(-bits_per_key * kLn2Squared);
+}
+
+std::vector<double>
+MonkeyFilterPolicy::AllocateBits(const std::vector<double> &entries_per_level,
+                                 double total_bits) {
+  std::vector<double> bits(entries_per_level.size(), 0);
+  std::vector<bool> active(entries_per_level.size());
+  for (size_t i = 0; i < entries_per_level.size(); i++) {
+    active[i] = entries_per_level[i] > 0;
+  }
+
+  // Lagrange gives p_i = n_i / mu; a level whose p_i reaches 1 gets no
+  // filter and the rest is solved again without it
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    double sum_n = 0, sum_n_ln_n = 0;
+    for (size_t i = 0; i < entries_per_level.size(); i++) {
+      if (active[i]) {
+        sum_n += entries_per_level[i];
+        sum_n_ln_n += entries_per_level[i] * std::log(entries_per_level[i]);
+      }
+    }
+    if (sum_n == 0) {
+      break;
+    }
+
+    double ln_mu = (total_bits * kLn2Squared + sum_n_ln_n) / sum_n;
+    for (size_t i = 0; i < entries_per_level.size(); i++) {
+      if (!active[i]) {
+        continue;
+      }
+      bits[i] = (ln_mu - std::log(entries_per_level[i])) / kLn2Squared;
+      if (bits[i] <= 0) {
+        bits[i] = 0;
+        active[i] = false;
+        changed = true;
+      }
+    }
+  }
+
+  // levels the data is not expected to reach get the deepest allocation
+  double deepest = 0;
+  for (size_t i = 0; i < entries_per_level.size(); i++) {
+    if (entries_per_level[i] > 0) {
+      deepest = bits[i];
+    } else {
+      bits[i] = deepest;
+    }
+  }
+  return bits;
+}
+
+std::vector<double> MonkeyFilterPolicy::ExpectedEntriesPerLevel(
+    int num_levels, double buffer_entries, double size_ratio,
+    double num_entries, int level0_runs, int smaller_lvl_runs_count) {
+  std::vector<double> entries(num_levels, 0);
+  double remaining = num_entries;
+
+  for (int level = 0; level < num_levels && remaining > 0; level++) {
+    double capacity;
+    if (level == 0) {
+      capacity = buffer_entries * level0_runs;
+    } else if (smaller_lvl_runs_count > 0) {
+      int lazy_level =
+          level == 1 ? 0
+                     : std::ceil((level - 1.0) / (smaller_lvl_runs_count + 1));
+      capacity = buffer_entries * std::pow(size_ratio, lazy_level);
+    } else {
+      capacity = buffer_entries * std::pow(size_ratio, level);
+    }
+    entries[level] = std::min(capacity, remaining);
+    remaining -= entries[level];
+  }
+  return entries;
+}
+
+void MonkeyFilterPolicy::PrintAllocation(
+    std::shared_ptr<Buffer> &buffer) const {
+  double total_fpr = 0, total_bytes = 0;
+  for (size_t level = 0; level < bits_.size(); level++) {
+    if (entries_[level] <= 0) {
+      continue;
+    }
+    double fpr = FalsePositiveRate(bits_[level]);
+    double bytes = entries_[level] * bits_[level] / 8;
+    total_fpr += fpr;
+    total_bytes += bytes;
+    (*buffer) << "[Monkey] level=" << level
+              << " expected_entries=" << (uint64_t)entries_[level]
+              << " bits_per_key=" << bits_[level] << " fpr=" << fpr
+              << " filter_bytes=" << (uint64_t)bytes << std::endl;
+  }
+  (*buffer) << "[Monkey] sum_fpr=" << total_fpr
+            << " filter_bytes=" << (uint64_t)total_bytes << std::endl;
+}
+
+void MonkeyFilterPolicy::LogFilterStats(DB *db,
+                                        std::shared_ptr<Buffer> &buffer) const {
+  std::vector<LiveFileMetaData> files;
+  db->GetLiveFilesMetaData(&files);
+  TablePropertiesCollection props;
+  db->GetPropertiesOfAllTables(&props);
+
+  std::map<int, std::pair<uint64_t, uint64_t>> per_level; // filter, entries
+  for (auto &file : files) {
+    auto it = props.find(file.db_path + file.name);
+    if (it == props.end()) {
+      continue;
+    }
+    per_level[file.level].first += it->second->filter_size;
+    per_level[file.level].second += it->second->num_entries;
+  }
+
+  auto *level_perf = get_perf_context()->level_to_perf_context;
+  for (auto &level : per_level) {
+    uint64_t entries = level.second.second;
+    (*buffer) << "[Monkey] level=" << level.first << " entries=" << entries
+              << " filter_bytes=" << level.second.first << " bits_per_key="
+              << (entries ? level.second.first * 8.0 / entries : 0);
+
+    if (level_perf != nullptr && level_perf->count(level.first)) {
+      // negatives the filter caught and positives it let through wrongly
+      PerfContextByLevel &perf = (*level_perf)[level.first];
+      uint64_t false_positives = perf.bloom_filter_full_positive -
+                                 perf.bloom_filter_full_true_positive;
+      uint64_t negatives = perf.bloom_filter_useful + false_positives;
+      (*buffer) << " measured_fpr="
+                << (negatives ? (double)false_positives / negatives : 0);
+    }
+    (*buffer) << std::endl;
+  }
+}
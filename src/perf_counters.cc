@@ -0,0 +1,169 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+struct CounterConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+const CounterConfig kConfigs[PerfCounters::kNumCounters] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}};
+
+int OpenCounter(const CounterConfig &config, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = config.type;
+  attr.config = config.config;
+  attr.disabled = group_fd < 0 ? 1 : 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // calling thread, any cpu
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+} // namespace
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+const char *PerfCounters::CounterName(int counter) {
+  switch (counter) {
+  case kCycles:
+    return "cycles";
+  case kInstructions:
+    return "instructions";
+  case kLLCMisses:
+    return "llc_misses";
+  case kBranchMisses:
+    return "branch_misses";
+  case kDTLBMisses:
+    return "dtlb_misses";
+  default:
+    return "unknown";
+  }
+}
+
+bool PerfCounters::Open() {
+  leader_ = OpenCounter(kConfigs[kCycles], -1);
+  if (leader_ < 0) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: perf_event_open failed (" << strerror(errno)
+              << "), hardware counters disabled; see "
+              << "/proc/sys/kernel/perf_event_paranoid" << std::endl;
+    return false;
+  }
+  fds_[kCycles] = leader_;
+  slot_[kCycles] = num_open_++;
+  for (int counter = kCycles + 1; counter < kNumCounters; counter++) {
+    int fd = OpenCounter(kConfigs[counter], leader_);
+    if (fd < 0) {
+      std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+                << "]: counter " << CounterName(counter)
+                << " unavailable: " << strerror(errno) << std::endl;
+      continue;
+    }
+    fds_[counter] = fd;
+    slot_[counter] = num_open_++;
+  }
+  ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+// values[c] is the running count of counter c, the times are cumulative
+// since Open; the group was on the PMU the whole time between two reads iff
+// both times grew by the same amount
+bool PerfCounters::Read(uint64_t *values, uint64_t *time_enabled,
+                        uint64_t *time_running) {
+  if (leader_ < 0) {
+    return false;
+  }
+  // nr, time_enabled, time_running, one value per open counter
+  uint64_t data[3 + kNumCounters];
+  ssize_t size = read(leader_, data, sizeof(data));
+  if (size < (ssize_t)(3 * sizeof(uint64_t))) {
+    return false;
+  }
+  *time_enabled = data[1];
+  *time_running = data[2];
+  for (int counter = 0; counter < kNumCounters; counter++) {
+    values[counter] = slot_[counter] >= 0 ? data[3 + slot_[counter]] : 0;
+  }
+  return true;
+}
+
+void PerfCounters::End(const char *label, const char *rep, uint64_t ops) {
+  uint64_t end[kNumCounters], end_enabled, end_running;
+  if (!begin_valid_ || !Read(end, &end_enabled, &end_running) ||
+      end_enabled - begin_enabled_ != end_running - begin_running_) {
+    begin_valid_ = false;
+    dropped_++;
+    return;
+  }
+  Aggregate &aggregate = aggregates_[{label, rep}];
+  aggregate.samples++;
+  aggregate.ops += ops;
+  for (int counter = 0; counter < kNumCounters; counter++) {
+    aggregate.totals[counter] += end[counter] - begin_[counter];
+  }
+  begin_valid_ = false;
+}
+
+void PerfCounters::PrintSummary(std::ostream &out) {
+  if (!IsOpen()) {
+    return;
+  }
+  for (auto &entry : aggregates_) {
+    const Aggregate &aggregate = entry.second;
+    if (aggregate.ops == 0) {
+      continue;
+    }
+    out << "[Perf] op=" << entry.first.first << " rep=" << entry.first.second
+        << " samples=" << aggregate.samples << " ops=" << aggregate.ops;
+    for (int counter = 0; counter < kNumCounters; counter++) {
+      out << " " << CounterName(counter) << "/op=";
+      if (slot_[counter] < 0) {
+        out << "n/a";
+      } else {
+        out << std::fixed << std::setprecision(1)
+            << (double)aggregate.totals[counter] / aggregate.ops;
+      }
+    }
+    if (slot_[kInstructions] >= 0 && aggregate.totals[kCycles] > 0) {
+      out << " ipc=" << std::setprecision(2)
+          << (double)aggregate.totals[kInstructions] /
+                 aggregate.totals[kCycles];
+    }
+    out << std::defaultfloat << std::endl;
+  }
+  out << "[Perf] dropped_samples=" << dropped_ << std::endl;
+}
+
+void PerfCounters::PrintSummary(std::shared_ptr<Buffer> &buffer) {
+  std::ostringstream out;
+  PrintSummary(out);
+  (*buffer) << out.str();
+}
@@ -0,0 +1,52 @@
+#include "rate_limit_controller.h"
+
+#include <algorithm>
+
+RateLimitController::RateLimitController(std::shared_ptr<RateLimiter> limiter,
+                                         uint64_t target_p99_ns,
+                                         int64_t max_bytes_per_sec,
+                                         long window_ops,
+                                         std::shared_ptr<Buffer> &buffer)
+    : limiter_(limiter),
+      buffer_(buffer),
+      target_p99_ns_(target_p99_ns),
+      max_bytes_per_sec_(max_bytes_per_sec),
+      min_bytes_per_sec_(std::max<int64_t>(max_bytes_per_sec / kMaxCutFactor,
+                                           1)),
+      bytes_per_sec_(max_bytes_per_sec),
+      window_ops_(std::max(window_ops, 1L)),
+      lowest_bytes_per_sec_(max_bytes_per_sec) {}
+
+void RateLimitController::Adjust() {
+  uint64_t p99 = window_.Percentile(99);
+  window_.Reset();
+  num_windows_++;
+
+  int64_t rate = bytes_per_sec_;
+  if (p99 > target_p99_ns_) {
+    rate = std::max<int64_t>(rate * kDecrease, min_bytes_per_sec_);
+  } else {
+    rate = std::min<int64_t>(rate + max_bytes_per_sec_ * kIncrease,
+                             max_bytes_per_sec_);
+  }
+  if (rate == bytes_per_sec_) {
+    return;
+  }
+
+  (*buffer_) << "[RateLimit] window=" << num_windows_ << " p99=" << p99
+             << " target=" << target_p99_ns_ << " bytes_per_sec "
+             << bytes_per_sec_ << " -> " << rate << std::endl;
+  bytes_per_sec_ = rate;
+  lowest_bytes_per_sec_ = std::min(lowest_bytes_per_sec_, rate);
+  num_adjustments_++;
+  limiter_->SetBytesPerSecond(rate);
+}
+
+void RateLimitController::PrintSummary() {
+  (*buffer_) << "[RateLimit] windows: " << num_windows_
+             << ", adjustments: " << num_adjustments_
+             << ", lowest_bytes_per_sec: " << lowest_bytes_per_sec_
+             << ", final_bytes_per_sec: " << bytes_per_sec_
+             << ", bytes_through: " << limiter_->GetTotalBytesThrough()
+             << std::endl;
+}
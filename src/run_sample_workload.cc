@@ -7,67 +7,35 @@
 #include <tuple>
 #include <thread>
 
+#include "aux_time.h"
 #include "config_options.h"
+#include "perf_counters.h"
 #include "utils.h"
 
 std::string sample_buffer_file = std::getenv("SAMPLE_WORKLOAD_STAT_PATH");
 const int MAX_RESERVED_ENTRY_COUNT = 10;
 
-struct KVPair {
-  std::string key;
-  std::string value;
+// hardware counters around every test phase, nullptr when off
+std::unique_ptr<PerfCounters> phase_counters = nullptr;
 
-  static bool compare_(const KVPair &a, const KVPair &b) {
-    return a.key.compare(b.key) < 0;
+void PhaseBegin() {
+  if (phase_counters) {
+    phase_counters->Begin();
   }
-};
+}
 
-struct PerformanceMatrix {
-  double insertTime;    // average insert time per unit
-  double sortingTime;   // Only used in vector: average sorting time of a full vector
-  double readTime;      // average Point read time per unit
-  double scanTime;      // average Range scan time per unit
-  double sstFlushTime;  // Only needed by SkipList and HashSkipList: average sst flush time
-  double sstReadTime;   // Only needed by SkipList and HashSkipList: average Point read time per unit in sst files
-  double sstScanTime;   // Only needed by SkipList and HashSkipList: average Range scan time per unit in sst files
-
-  double numEntriesRatioToVec; // ratio of number of entries current data structure can hold when the memtable is full/scheduled
-                               // for flush compared to Vector since Vector has the lowest memory overhead
-
-  static PerformanceMatrix *GetNewPerfMatrix() {
-    PerformanceMatrix *matrix = (PerformanceMatrix *)malloc(sizeof(PerformanceMatrix));
-    matrix->insertTime = 0;
-    matrix->sortingTime = 0;
-    matrix->readTime = 0;
-    matrix->scanTime = 0;
-    matrix->sstFlushTime = 0;
-    matrix->sstReadTime = 0;
-    matrix->sstScanTime = 0;
-    return matrix;
+void PhaseEnd(const char *phase, const std::string &rep, uint64_t ops) {
+  if (phase_counters) {
+    phase_counters->End(phase, rep.c_str(), ops);
   }
+}
 
-  void PrintPerfMatrix(const char *type) {
-    printf("Data Structure Type:  %s\n"
-           "InsertTime:           %f\n"
-           "SortingTime:          %f\n"
-           "ReadTime:             %f\n"
-           "ScanTime:             %f\n"
-           "sstFlushTime:         %f\n"
-           "sstReadTime:          %f\n"
-           "sstScanTime:          %f\n"
-           "numEntriesRatioToVec: %f\n", type,
-          insertTime, sortingTime, readTime, scanTime, sstFlushTime, sstReadTime, sstScanTime, numEntriesRatioToVec);
-  }
+struct KVPair {
+  std::string key;
+  std::string value;
 
-  void FlushToBuffer(std::shared_ptr<Buffer> buffer) {
-    (*buffer) << insertTime << std::endl
-              << sortingTime << std::endl
-              << readTime << std::endl
-              << scanTime << std::endl
-              << sstFlushTime << std::endl
-              << sstReadTime << std::endl
-              << sstScanTime << std::endl
-              << numEntriesRatioToVec << std::endl;
+  static bool compare_(const KVPair &a, const KVPair &b) {
+    return a.key.compare(b.key) < 0;
   }
 };
 
@@ -124,6 +92,7 @@ PerformanceMatrix *TestVectorPerformance(std::vector<KVPair> &kvPairs, Options &
   unsigned long insertTimeTotal = 0;
   int i = 0;
   size_t reservedSpace = sizeof(KVPair) * MAX_RESERVED_ENTRY_COUNT;
+  PhaseBegin();
   for (i = 0;i < kvPairs.size(); i++) {
     KVPair kv = kvPairs[i];
     // Check if we the memtable is about to be scheduled to flush before current insert
@@ -131,12 +100,11 @@ PerformanceMatrix *TestVectorPerformance(std::vector<KVPair> &kvPairs, Options &
       break;
     }
 
-    auto start = std::chrono::high_resolution_clock::now();
+    my_ticks start = my_ticks_start();
     s = db->Put(write_options, kv.key, kv.value);
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-    insertTimeTotal += duration.count();
+    insertTimeTotal += my_ticks_to_ns(my_ticks_stop() - start);
   }
+  PhaseEnd("insert", "Vector", i);
   perf->insertTime = ((double)insertTimeTotal / (double)(i));
   printf("Vector: average insert time is %f for %d inserts\n", perf->insertTime, i);
   // Record what records we have inserted here
@@ -149,12 +117,14 @@ PerformanceMatrix *TestVectorPerformance(std::vector<KVPair> &kvPairs, Options &
   printf("Vector: Number Entries a full vector can hold is around %d\n", numEntries);
 
   // Test 2: Test the average sorting time (including copy)
+  PhaseBegin();
   auto start = std::chrono::high_resolution_clock::now();
   for (int i = 0; i < 100; i++) {
     auto newVector = insertedKV;
     std::sort(newVector.begin(), newVector.end(), KVPair::compare_);
   }
   auto stop = std::chrono::high_resolution_clock::now();
+  PhaseEnd("sort", "Vector", 100);
   auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
   perf->sortingTime = ((double)duration.count() / (double)100);
   printf("Vector: average sorting time is %f\n", perf->sortingTime);
@@ -162,18 +132,21 @@ PerformanceMatrix *TestVectorPerformance(std::vector<KVPair> &kvPairs, Options &
   // Test 3: Test the average pointReadTime (after sort)
   auto sortedInsertedKV = insertedKV;
   std::sort(sortedInsertedKV.begin(), sortedInsertedKV.end(), KVPair::compare_);
+  PhaseBegin();
   start = std::chrono::high_resolution_clock::now();
   for (auto kv : sortedInsertedKV) {
     (void)std::equal_range(sortedInsertedKV.begin(), sortedInsertedKV.end(), kv,
                     KVPair::compare_);
   }
   stop = std::chrono::high_resolution_clock::now();
+  PhaseEnd("point_query", "Vector", sortedInsertedKV.size());
   duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
   perf->readTime = ((double)duration.count() / (double)sortedInsertedKV.size());
   printf("Vector: average point searching time is %f\n", perf->readTime);
 
   // Test 4: Test the average rangeScanTime (after sort)
   // Actually, we can simply calculate it as: average pointReadTime + tranversing half number of records
+  PhaseBegin();
   start = std::chrono::high_resolution_clock::now();
   i = 0;
   for (auto kv : sortedInsertedKV) {
@@ -183,6 +156,7 @@ PerformanceMatrix *TestVectorPerformance(std::vector<KVPair> &kvPairs, Options &
     };
   }
   stop = std::chrono::high_resolution_clock::now();
+  PhaseEnd("range_query", "Vector", 1);
   duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
   perf->scanTime = (double) duration.count() + perf->scanTime;
   printf("Vector: average range searching time is %f\n", perf->readTime);
@@ -245,6 +219,7 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
   unsigned long insertTimeTotal = 0;
   int i = 0;
   size_t reservedSpace = sizeof(KVPair) * MAX_RESERVED_ENTRY_COUNT;
+  PhaseBegin();
   for (i = 0;i < kvPairs.size(); i++) {
     KVPair kv = kvPairs[i];
     // Check if we the memtable is about to be scheduled to flush before current insert
@@ -252,12 +227,11 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
       break;
     }
 
-    auto start = std::chrono::high_resolution_clock::now();
+    my_ticks start = my_ticks_start();
     s = db->Put(write_options, kv.key, kv.value);
-    auto stop = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-    insertTimeTotal += duration.count();
+    insertTimeTotal += my_ticks_to_ns(my_ticks_stop() - start);
   }
+  PhaseEnd("insert", memTableType, i);
   perf->insertTime = ((double)insertTimeTotal / (double)(i));
   printf("%s: average insert time is %f for %d inserts\n", memTableType.c_str(), perf->insertTime, i);
   // Record what records we have inserted here
@@ -271,6 +245,7 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
 
   // Test 2: Test the average reading time (random)
   // We test (insertedKV.size() / 10) reads here and get the average
+  PhaseBegin();
   auto start = std::chrono::high_resolution_clock::now();
   int maxNumRead = insertedKV.size() / 10;
   for (int i = 0; i < maxNumRead; i++) {
@@ -281,6 +256,7 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
     s = db->Get(read_options, kv.key, &value);
   }
   auto stop = std::chrono::high_resolution_clock::now();
+  PhaseEnd("point_query", memTableType, maxNumRead);
   auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
   perf->readTime = ((double)duration.count() / (double)maxNumRead);
   printf("%s: average reading time is %f\n", memTableType.c_str(), perf->readTime);
@@ -289,6 +265,7 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
   std::string start_key, end_key;
   auto sortedInsertedKV = insertedKV;
   std::sort(sortedInsertedKV.begin(), sortedInsertedKV.end(), KVPair::compare_);
+  PhaseBegin();
   start = std::chrono::high_resolution_clock::now();
   for (int i = 0; i < 100; i++) {
     int start_i = rand() % sortedInsertedKV.size();
@@ -304,6 +281,7 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
     }
   }
   stop = std::chrono::high_resolution_clock::now();
+  PhaseEnd("range_query", memTableType, 100);
   duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
   perf->scanTime = ((double)duration.count() / (double)100);
   printf("%s: average range search time is %f\n", memTableType.c_str(), perf->scanTime);
@@ -334,12 +312,14 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
   //    We know for sure that any KV Pair in insertedKV must be flushed to disk.
   int maxReadCount = 1000;
   std::string value;
+  PhaseBegin();
   start = std::chrono::high_resolution_clock::now();
   for (int i = 0; i < maxReadCount; i++) {
     int index = rand() % insertedKV.size();
     s = db->Get(read_options, insertedKV[index].key, &value);
   }
   stop = std::chrono::high_resolution_clock::now();
+  PhaseEnd("sst_point_query", memTableType, maxReadCount);
   duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
   perf->sstReadTime = ((double)duration.count() / (double)maxReadCount);
   printf("%s: average SST point scan time is %f\n", memTableType.c_str(), perf->sstReadTime);
@@ -349,6 +329,7 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
   std::sort(sortedKV.begin(), sortedKV.end(), KVPair::compare_);
   int scanKeyNum = (int)((float)sortedInsertedKV.size() * env->range_query_selectivity);
   int startLimit = sortedKV.size() - scanKeyNum;
+  PhaseBegin();
   start = std::chrono::high_resolution_clock::now();
   for (int i = 0; i < 100; i++) {
     int start_i = rand() % startLimit;
@@ -365,6 +346,7 @@ PerformanceMatrix *TestSkipListPerformance(std::vector<KVPair> &kvPairs, Options
     }
   }
   stop = std::chrono::high_resolution_clock::now();
+  PhaseEnd("sst_range_query", memTableType, 100);
   duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
   perf->sstScanTime = ((double)duration.count() / (double)100);
   printf("%s: average SST range search time is %f\n", memTableType.c_str(), perf->sstScanTime);
@@ -400,6 +382,13 @@ int runSampleWorkload(std::unique_ptr<DBEnv> &env) {
   //   std::make_shared<FlushListner>(buffer);
   // options.listeners.emplace_back(flush_listener);
 
+  if (env->perf_counters > 0) {
+    phase_counters.reset(new PerfCounters());
+    if (!phase_counters->Open()) {
+      phase_counters = nullptr;
+    }
+  }
+
   // Step 1: Generate sample workload here
   int keyLength = (int)(env->kv_entry_size * env->key_value_size_ratio);
   int valueLength = env->kv_entry_size - keyLength;
@@ -424,6 +413,10 @@ int runSampleWorkload(std::unique_ptr<DBEnv> &env) {
   buffer->flush();
 
   printf("Statistics of the random sample workload is flushed to file: %s\n", sample_buffer_file.c_str());
+  // kept out of the stat file, which is read back as the cost model
+  if (phase_counters) {
+    phase_counters->PrintSummary(std::cout);
+  }
   delete vectorPerf;
   delete skipListPerf;
   delete hashSkipListPerf;
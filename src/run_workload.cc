@@ -6,8 +6,20 @@
 #include <iostream>
 #include <tuple>
 
+#include "aux_time.h"
 #include "config_options.h"
+#include "fade_controller.h"
+#include "fluid_tuner.h"
+#include "latency_sampler.h"
+#include "memtable_switch_controller.h"
+#include "perf_counters.h"
+#include "rate_limit_controller.h"
+#include "stall_tracker.h"
+#include "stats_collector.h"
+#include "tombstone_collector.h"
+#include "trace_writer.h"
 #include "utils.h"
+#include "visibility_checker.h"
 
 std::string buffer_file = "workload.log";
 std::string stats_file = "stats.log";
@@ -22,11 +34,32 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
 
   configOptions(env, &options, &table_options, &write_options, &read_options,
                 &flush_options);
+  // the fork's own switching would race MemtableSwitchController for the
+  // same memtable boundary, only one of them may decide
   options.enable_dynamic_index_organization = false;
 
   std::shared_ptr<Buffer> buffer = std::make_unique<Buffer>(buffer_file);
   std::unique_ptr<Buffer> stats = std::make_unique<Buffer>(stats_file);
 
+  std::shared_ptr<MemtableSwitchController> switch_controller = nullptr;
+  std::shared_ptr<SwitchCostTracker> switch_cost = nullptr;
+  if (env->adaptive_memtable) {
+    const char *stat_path = std::getenv("SAMPLE_WORKLOAD_STAT_PATH");
+    switch_controller = std::make_shared<MemtableSwitchController>(env, buffer);
+    if (switch_controller->LoadCostModel(stat_path ? stat_path
+                                                   : "sample_workload.stat")) {
+      options.listeners.emplace_back(switch_controller);
+      if (env->switch_cost_tracking) {
+        switch_cost = std::make_shared<SwitchCostTracker>(buffer);
+        switch_controller->SetCostTracker(switch_cost);
+        options.listeners.emplace_back(switch_cost);
+      }
+    } else {
+      std::cerr << "Adaptive memtable disabled" << std::endl;
+      switch_controller = nullptr;
+    }
+  }
+
   // Add custom listners
   std::shared_ptr<CompactionsListner> compaction_listener =
       std::make_shared<CompactionsListner>();
@@ -35,6 +68,64 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
   std::shared_ptr<FlushListner> flush_listener =
       std::make_shared<FlushListner>(buffer);
   options.listeners.emplace_back(flush_listener);
+  if (switch_controller) {
+    flush_listener->SetRepSource([switch_controller] {
+      return std::string(
+          MemtableSwitchController::RepName(switch_controller->CurrentRep()));
+    });
+  }
+
+  std::shared_ptr<StatsCollector> stats_collector =
+      std::make_shared<StatsCollector>(env->stats_interval_ms);
+  options.listeners.emplace_back(stats_collector);
+
+  std::shared_ptr<VisibilityChecker> visibility_checker = nullptr;
+  if (env->verify_compactions > 0) {
+    visibility_checker =
+        std::make_shared<VisibilityChecker>(env->verify_compactions, buffer);
+    options.listeners.emplace_back(visibility_checker);
+  }
+
+  std::shared_ptr<TraceWriter> trace_writer = nullptr;
+  if (!env->trace_file.empty()) {
+    trace_writer = std::make_shared<TraceWriter>(env->trace_file,
+                                                 env->trace_sample_rate);
+    options.listeners.emplace_back(trace_writer);
+  }
+
+  std::shared_ptr<FluidLSM> tree = nullptr;
+  for (auto &listener : options.listeners) {
+    if (!tree) {
+      tree = std::dynamic_pointer_cast<FluidLSM>(listener);
+    }
+  }
+
+  std::shared_ptr<StallTracker> stall_tracker = nullptr;
+  if (env->track_stalls) {
+    stall_tracker = std::make_shared<StallTracker>(buffer);
+    options.listeners.emplace_back(stall_tracker);
+  }
+
+  std::shared_ptr<FadeController> fade_controller = nullptr;
+  if (env->delete_persistence_threshold > 0) {
+    fade_controller = std::make_shared<FadeController>(
+        env->delete_persistence_threshold, env->size_ratio, tree, buffer);
+    options.listeners.emplace_back(fade_controller);
+    Stats::getInstance()->delete_persistence_threshold =
+        env->delete_persistence_threshold;
+  }
+
+  if (tree) {
+    // FluidLSM compactions are not in RocksDB's pending work
+    compaction_listener->SetPendingWorkCheck(
+        [tree]() { return tree->HasPendingWork(); });
+    std::weak_ptr<CompactionsListner> waiter = compaction_listener;
+    tree->SetIdleCallback([waiter]() {
+      if (auto listener = waiter.lock()) {
+        listener->Notify();
+      }
+    });
+  }
 
   if (env->IsDestroyDatabaseEnabled()) {
     DestroyDB(env->kDBPath, options);
@@ -42,19 +133,59 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
   }
 
   PrintExperimentalSetup(env, buffer);
+  (*buffer) << "[Timer] source="
+            << (my_ticks_calibration.use_tsc ? "tsc" : "clock_gettime")
+            << " overhead_ns=" << my_ticks_overhead_ns()
+            << " latency_sample_rate=" << env->latency_sample_rate << std::endl;
+  std::shared_ptr<const MonkeyFilterPolicy> monkey_filters =
+      std::dynamic_pointer_cast<const MonkeyFilterPolicy>(
+          table_options.filter_policy);
+  if (monkey_filters) {
+    monkey_filters->PrintAllocation(buffer);
+  }
 
   Status s = DB::Open(options, env->kDBPath, &db);
   if (!s.ok())
     std::cerr << s.ToString() << std::endl;
   assert(s.ok());
-  Iterator *it = db->NewIterator(read_options);
+  // scans are key ranges, not prefixes, even while a hash memtable has a
+  // prefix extractor installed
+  ReadOptions scan_options = read_options;
+  scan_options.total_order_seek = true;
+  Iterator *it = db->NewIterator(scan_options);
 
-#ifdef DOSTO
-  if (env->debugging) {
-    tree->SetDebugMode(env->debugging);
+  if (tree && env->fluid_debug) {
     tree->PrintFluidLSM(db);
   }
-#endif // DOSTO
+  stats_collector->Start(db);
+  if (stall_tracker) {
+    stall_tracker->SetDB(db);
+  }
+  if (fade_controller) {
+    fade_controller->Start(db);
+  }
+
+  std::unique_ptr<RateLimitController> rate_controller = nullptr;
+  if (env->rate_limit_p99_us > 0) {
+    rate_controller = std::make_unique<RateLimitController>(
+        options.rate_limiter, env->rate_limit_p99_us * 1000,
+        options.rate_limiter->GetBytesPerSecond(), env->rate_limit_window,
+        buffer);
+  }
+
+  std::unique_ptr<FluidTuner> fluid_tuner = nullptr;
+  if (env->fluid_tune == 1) {
+    // offline: recommend a setting for the whole workload file
+    FluidTuner tuner(env, buffer);
+    if (tuner.ScanWorkload("workload.txt")) {
+      tuner.PrintRecommendation({(int)env->size_ratio,
+                                 env->smaller_lvl_runs_count,
+                                 env->larger_lvl_runs_count},
+                                0);
+    }
+  } else if (env->fluid_tune == 2 && tree) {
+    fluid_tuner = std::make_unique<FluidTuner>(env, buffer);
+  }
 
   // Clearing the system cache
   if (env->clear_system_cache) {
@@ -86,6 +217,19 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
 #endif // TIMER
   auto exec_start = std::chrono::high_resolution_clock::now();
 
+  // counts the replay thread only, so it is opened here
+  std::unique_ptr<PerfCounters> perf_counters = nullptr;
+  if (env->perf_counters > 0) {
+    perf_counters.reset(new PerfCounters());
+    if (!perf_counters->Open()) {
+      perf_counters = nullptr;
+    }
+  }
+
+  // times 1 in latency_sample_rate ops, throughput still counts all of them
+  LatencySampler latency_sampler(env->latency_sample_rate);
+
+  Stats *op_stats = Stats::getInstance();
   std::string line;
   unsigned long ith_op = 0;
   while (std::getline(workload_file, line)) {
@@ -96,6 +240,16 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
     std::istringstream stream(line);
     char operation;
     stream >> operation;
+    uint64_t op_latency = 0;
+    bool timed = latency_sampler.Next();
+    // ops a timed op stands for, 0 if this one was not timed
+    uint64_t latency_weight = timed ? latency_sampler.Weight() : 0;
+    bool perf_sample = perf_counters && ith_op % env->perf_counters == 0;
+    const char *perf_rep =
+        perf_sample ? MemtableSwitchController::RepName(
+                          switch_controller ? switch_controller->CurrentRep()
+                                            : env->memtable_factory)
+                    : nullptr;
 
     switch (operation) {
       // [Insert]
@@ -103,16 +257,33 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
       std::string key, value;
       stream >> key >> value;
 
+      if (perf_sample) {
+        perf_counters->Begin();
+      }
 #ifdef TIMER
-      auto start = std::chrono::high_resolution_clock::now();
+      my_ticks start = timed ? my_ticks_start() : 0;
 #endif // TIMER
       s = db->Put(write_options, key, value);
 #ifdef TIMER
-      auto stop = std::chrono::high_resolution_clock::now();
-      auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-      (*stats) << "InsertTime: " << duration.count() << std::endl;
-      inserts_exec_time += duration.count();
+      uint64_t duration =
+          timed ? my_ticks_to_ns(my_ticks_stop() - start) : 0;
+#endif // TIMER
+      if (perf_sample) {
+        perf_counters->End("insert", perf_rep);
+      }
+#ifdef TIMER
+      if (timed) {
+        (*stats) << "InsertTime: " << duration << std::endl;
+        inserts_exec_time += duration * latency_sampler.Weight();
+        op_latency = duration;
+      }
 #endif // TIMER
+      if (visibility_checker && s.ok()) {
+        visibility_checker->RecordPut(key, value);
+      }
+      if (s.ok()) {
+        flush_listener->RecordWrite(key.size() + value.size());
+      }
       break;
     }
       // [Update]
@@ -120,16 +291,33 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
       std::string key, value;
       stream >> key >> value;
 
+      if (perf_sample) {
+        perf_counters->Begin();
+      }
 #ifdef TIMER
-      auto start = std::chrono::high_resolution_clock::now();
+      my_ticks start = timed ? my_ticks_start() : 0;
 #endif // TIMER
       s = db->Put(write_options, key, value);
 #ifdef TIMER
-      auto stop = std::chrono::high_resolution_clock::now();
-      auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-      (*stats) << "UpdateTime: " << duration.count() << std::endl;
-      updates_exec_time += duration.count();
+      uint64_t duration =
+          timed ? my_ticks_to_ns(my_ticks_stop() - start) : 0;
+#endif // TIMER
+      if (perf_sample) {
+        perf_counters->End("update", perf_rep);
+      }
+#ifdef TIMER
+      if (timed) {
+        (*stats) << "UpdateTime: " << duration << std::endl;
+        updates_exec_time += duration * latency_sampler.Weight();
+        op_latency = duration;
+      }
 #endif // TIMER
+      if (visibility_checker && s.ok()) {
+        visibility_checker->RecordPut(key, value);
+      }
+      if (s.ok()) {
+        flush_listener->RecordWrite(key.size() + value.size());
+      }
       break;
     }
       // [PointDelete]
@@ -137,16 +325,39 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
       std::string key;
       stream >> key;
 
+      if (perf_sample) {
+        perf_counters->Begin();
+      }
 #ifdef TIMER
-      auto start = std::chrono::high_resolution_clock::now();
+      my_ticks start = timed ? my_ticks_start() : 0;
 #endif // TIMER
       s = db->Delete(write_options, key);
 #ifdef TIMER
-      auto stop = std::chrono::high_resolution_clock::now();
-      auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-      (*stats) << "DeleteTime: " << duration.count() << std::endl;
-      pdelete_exec_time += duration.count();
+      uint64_t duration =
+          timed ? my_ticks_to_ns(my_ticks_stop() - start) : 0;
 #endif // TIMER
+      if (perf_sample) {
+        perf_counters->End("delete", perf_rep);
+      }
+#ifdef TIMER
+      if (timed) {
+        (*stats) << "DeleteTime: " << duration << std::endl;
+        pdelete_exec_time += duration * latency_sampler.Weight();
+        op_latency = duration;
+      }
+#endif // TIMER
+      if (visibility_checker && s.ok()) {
+        visibility_checker->RecordDelete(key);
+      }
+      if (s.ok()) {
+        flush_listener->RecordWrite(key.size());
+      }
+      if (s.ok()) {
+        SeqnoTimeMap::GetInstance()->RecordDelete(db);
+      }
+      if (fade_controller && s.ok()) {
+        fade_controller->RecordDelete(db, key);
+      }
       break;
     }
       // [ProbePointQuery]
@@ -154,15 +365,26 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
       std::string key, value;
       stream >> key;
 
+      if (perf_sample) {
+        perf_counters->Begin();
+      }
 #ifdef TIMER
-      auto start = std::chrono::high_resolution_clock::now();
+      my_ticks start = timed ? my_ticks_start() : 0;
 #endif // TIMER
       s = db->Get(read_options, key, &value);
 #ifdef TIMER
-      auto stop = std::chrono::high_resolution_clock::now();
-      auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-      (*stats) << "GetTime: " << duration.count() << std::endl;
-      pq_exec_time += duration.count();
+      uint64_t duration =
+          timed ? my_ticks_to_ns(my_ticks_stop() - start) : 0;
+#endif // TIMER
+      if (perf_sample) {
+        perf_counters->End("point_query", perf_rep);
+      }
+#ifdef TIMER
+      if (timed) {
+        (*stats) << "GetTime: " << duration << std::endl;
+        pq_exec_time += duration * latency_sampler.Weight();
+        op_latency = duration;
+      }
 #endif // TIMER
       break;
     }
@@ -173,8 +395,11 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
 
       uint64_t keys_returned = 0, keys_read = 0;
       bool did_run_RR = false;
+      if (perf_sample) {
+        perf_counters->Begin();
+      }
 #ifdef TIMER
-      auto start = std::chrono::high_resolution_clock::now();
+      my_ticks start = timed ? my_ticks_start() : 0;
 #endif // TIMER
 
       it->Refresh();
@@ -189,10 +414,18 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
         (*buffer) << it->status().ToString() << std::endl << std::flush;
       }
 #ifdef TIMER
-      auto stop = std::chrono::high_resolution_clock::now();
-      auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
-      (*stats) << "ScanTime: " << duration.count() << std::endl;
-      rq_exec_time += duration.count();
+      uint64_t duration =
+          timed ? my_ticks_to_ns(my_ticks_stop() - start) : 0;
+#endif // TIMER
+      if (perf_sample) {
+        perf_counters->End("range_query", perf_rep);
+      }
+#ifdef TIMER
+      if (timed) {
+        (*stats) << "ScanTime: " << duration << std::endl;
+        rq_exec_time += duration * latency_sampler.Weight();
+        op_latency = duration;
+      }
 #endif // TIMER
       break;
     }
@@ -201,6 +434,53 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
       break;
     }
 
+    switch (operation) {
+    case 'I':
+      op_stats->inserts_completed++;
+      break;
+    case 'U':
+      op_stats->updates_completed++;
+      break;
+    case 'D':
+      op_stats->point_deletes_completed++;
+      break;
+    case 'Q':
+      op_stats->point_queries_completed++;
+      break;
+    case 'S':
+      op_stats->range_queries_completed++;
+      break;
+    }
+
+    if (switch_controller) {
+      // untimed ops add 0, timed ones their weight, so the mean holds
+      switch_controller->RecordOp(OpTypeFromCode(operation),
+                                  op_latency * latency_weight);
+      switch_controller->MaybeSwitch(db);
+    }
+    if (switch_cost && operation != 'Q' && operation != 'S') {
+      switch_cost->OnForegroundWrite(db, op_latency, latency_weight);
+    }
+    if (visibility_checker) {
+      visibility_checker->MaybeVerify(db);
+    }
+    if (tree && timed) {
+      tree->RecordForegroundLatency(op_latency, latency_weight);
+    }
+    if (stall_tracker && timed && operation != 'Q' && operation != 'S') {
+      stall_tracker->RecordOp(op_latency, latency_weight);
+    }
+    if (rate_controller && timed) {
+      rate_controller->RecordOp(op_latency, latency_weight);
+    }
+    if (trace_writer && timed) {
+      trace_writer->RecordOp(operation, op_latency);
+    }
+    if (fluid_tuner) {
+      fluid_tuner->RecordOp(OpTypeFromCode(operation));
+      fluid_tuner->MaybeRetune(db, tree.get());
+    }
+
     ith_op += 1;
     UpdateProgressBar(env, ith_op, total_operations,
                       (int)total_operations * 0.02);
@@ -208,6 +488,52 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
       break;
   }
 
+  if (switch_controller) {
+    switch_controller->PrintSummary();
+  }
+  if (switch_cost) {
+    switch_cost->PrintSummary(db);
+  }
+  if (tree) {
+    (*buffer) << "[FluidLSM] T=" << tree->GetSizeRatio()
+              << " K=" << tree->GetSmallerLevelRunsCount()
+              << " Z=" << tree->GetLargerLevelRunsCount()
+              << " view_mismatches=" << tree->GetConsistencyMismatches()
+              << std::endl;
+    (*buffer) << tree->CompactionReport() << std::endl;
+  }
+  if (visibility_checker) {
+    visibility_checker->MaybeVerify(db);
+    visibility_checker->PrintSummary();
+  }
+  if (monkey_filters) {
+    monkey_filters->LogFilterStats(db, buffer);
+  }
+  if (rate_controller) {
+    rate_controller->PrintSummary();
+  }
+  flush_listener->PrintSummary();
+  if (perf_counters) {
+    perf_counters->PrintSummary(buffer);
+  }
+  if (stall_tracker) {
+    (*buffer) << "[Stall] memtable_factory=" << env->memtable_factory
+              << std::endl;
+    stall_tracker->PrintSummary(options.statistics);
+  }
+  if (fade_controller) {
+    fade_controller->Stop();
+    fade_controller->PrintSummary();
+  }
+  stats_collector->Stop();
+  StatsCollector::Refresh(db);
+  {
+    std::ostringstream final_stats;
+    op_stats->printStats(final_stats);
+    op_stats->printFadeFileInfo(final_stats);
+    (*buffer) << "[Stats]" << std::endl << final_stats.str();
+  }
+
 #ifdef PROFILE
   (*buffer) << "=====================" << std::endl;
   LogTreeState(db, buffer);
@@ -240,6 +566,11 @@ int runWorkload(std::unique_ptr<DBEnv> &env) {
     std::cerr << s.ToString() << std::endl;
   assert(s.ok());
 
+  // background jobs are done once the db is closed
+  if (trace_writer && trace_writer->Write()) {
+    (*buffer) << "[Trace] written to " << env->trace_file << std::endl;
+  }
+
   PrintRocksDBPerfStats(env, buffer, options);
   table_options.block_cache.reset();
   options.table_factory.reset();
@@ -0,0 +1,128 @@
+#include "stall_tracker.h"
+
+#include <algorithm>
+#include <map>
+
+StallTracker::StallTracker(std::shared_ptr<Buffer> &buffer)
+    : buffer_(buffer), start_ns_(NowNanos()) {}
+
+std::string StallTracker::GetStallCause() {
+  DB *db = db_.load();
+  if (db == nullptr) {
+    return "unknown";
+  }
+  const Options &options = db->GetOptions();
+  uint64_t immutable_memtables = 0, l0_files = 0, pending_bytes = 0;
+  db->GetIntProperty("rocksdb.num-immutable-mem-table", &immutable_memtables);
+  db->GetIntProperty("rocksdb.num-files-at-level0", &l0_files);
+  db->GetIntProperty("rocksdb.estimate-pending-compaction-bytes",
+                     &pending_bytes);
+
+  // same conditions and order as RocksDB's RecalculateWriteStallConditions:
+  // every stop condition before any delay one, and no L0 or pending bytes
+  // conditions without auto compactions (FluidLSM)
+  uint64_t max_memtables = options.max_write_buffer_number;
+  bool auto_compactions = !options.disable_auto_compactions;
+  if (immutable_memtables >= max_memtables) {
+    return "memtables";
+  }
+  if (auto_compactions &&
+      l0_files >= (uint64_t)options.level0_stop_writes_trigger) {
+    return "l0_files";
+  }
+  if (auto_compactions && options.hard_pending_compaction_bytes_limit > 0 &&
+      pending_bytes >= options.hard_pending_compaction_bytes_limit) {
+    return "pending_compaction_bytes";
+  }
+  if (max_memtables > 3 && immutable_memtables >= max_memtables - 1 &&
+      immutable_memtables - 1 >=
+          (uint64_t)options.min_write_buffer_number_to_merge) {
+    return "memtables";
+  }
+  if (auto_compactions && options.level0_slowdown_writes_trigger >= 0 &&
+      l0_files >= (uint64_t)options.level0_slowdown_writes_trigger) {
+    return "l0_files";
+  }
+  if (auto_compactions && options.soft_pending_compaction_bytes_limit > 0 &&
+      pending_bytes >= options.soft_pending_compaction_bytes_limit) {
+    return "pending_compaction_bytes";
+  }
+  return "unknown";
+}
+
+void StallTracker::OnStallConditionsChanged(const WriteStallInfo &info) {
+  uint64_t now = NowNanos();
+  bool stalls = info.condition.cur != WriteStallCondition::kNormal;
+  std::string cause = stalls ? GetStallCause() : "";
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // a delay turning into a stop (or back) closes one interval, opens another
+  if (!stalls_.empty() && stalls_.back().end_ns == 0) {
+    stalls_.back().end_ns = now;
+    last_stall_end_ns_.store(now, std::memory_order_release);
+  }
+  if (stalls) {
+    StallInterval stall;
+    stall.cause = cause;
+    stall.stopped = info.condition.cur == WriteStallCondition::kStopped;
+    stall.start_ns = now;
+    stall.end_ns = 0;
+    stalls_.push_back(stall);
+  }
+  stalled_.store(stalls, std::memory_order_release);
+}
+
+void StallTracker::RecordStalledOp(uint64_t latency_ns, uint64_t count) {
+  stalled_ops_.Add(latency_ns, count);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stalls_.empty()) {
+    return;
+  }
+  // the latest stall is the one the op waited on last
+  StallInterval &stall = stalls_.back();
+  stall.overlapping_ops += count;
+  stall.max_op_latency_ns = std::max(stall.max_op_latency_ns, latency_ns);
+}
+
+void StallTracker::PrintSummary(const std::shared_ptr<Statistics> &statistics) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t now = NowNanos();
+  std::map<std::string, std::pair<long, uint64_t>> by_cause;
+  uint64_t total_ns = 0;
+  for (auto &stall : stalls_) {
+    uint64_t end = stall.end_ns == 0 ? now : stall.end_ns;
+    uint64_t duration = end - stall.start_ns;
+    total_ns += duration;
+    std::string key =
+        stall.cause + (stall.stopped ? "/stopped" : "/delayed");
+    by_cause[key].first++;
+    by_cause[key].second += duration;
+    (*buffer_) << "[Stall] cause=" << stall.cause
+               << " condition=" << (stall.stopped ? "stopped" : "delayed")
+               << " start_ms=" << (stall.start_ns - start_ns_) / 1000000
+               << " duration_us=" << duration / 1000
+               << " overlapping_ops=" << stall.overlapping_ops
+               << " max_op_latency_us=" << stall.max_op_latency_ns / 1000
+               << std::endl;
+  }
+  for (auto &cause : by_cause) {
+    (*buffer_) << "[Stall] summary cause=" << cause.first
+               << " count=" << cause.second.first
+               << " total_us=" << cause.second.second / 1000 << std::endl;
+  }
+
+  uint64_t p99 = all_ops_.Percentile(99);
+  uint64_t tail = all_ops_.CountAtLeast(p99);
+  uint64_t stalled_tail = stalled_ops_.CountAtLeast(p99);
+  (*buffer_) << "[Stall] stalls=" << stalls_.size()
+             << " total_us=" << total_ns / 1000;
+  if (statistics) {
+    (*buffer_) << " rocksdb_stall_micros="
+               << statistics->getTickerCount(STALL_MICROS);
+  }
+  (*buffer_) << " p99_ns=" << p99 << " p99_tail_ops=" << tail
+             << " p99_tail_ops_in_stall=" << stalled_tail << std::endl;
+  (*buffer_) << "[Stall] stalled_ops(" << stalled_ops_.ToString()
+             << ") unstalled_ops(" << unstalled_ops_.ToString() << ")"
+             << std::endl;
+}
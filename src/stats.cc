@@ -4,6 +4,7 @@
  */
 
 #include <iostream>
+#include <algorithm>
 #include <cmath>
 #include <sys/time.h>
 #include <iomanip>
@@ -16,17 +17,17 @@ Stats* Stats::instance = 0;
 
 Stats::Stats() 
 {
-  key_size = -1;
-  value_size = -1;
-  inserts_completed = -1;
-  updates_completed = -1;
-  update_proportion = -1;
-  point_deletes_completed = -1;
-  range_deletes_completed = -1;
-  point_queries_completed = -1;
-  range_queries_completed = -1;
+  key_size = 0;
+  value_size = 0;
+  inserts_completed = 0;
+  updates_completed = 0;
+  update_proportion = 0;
+  point_deletes_completed = 0;
+  range_deletes_completed = 0;
+  point_queries_completed = 0;
+  range_queries_completed = 0;
   
-  // current tree stats
+  // current tree stats, -1 until StatsCollector has looked at the tree
   levels_in_tree = -1;
   files_in_tree = -1;
   key_values_in_tree = -1;
@@ -36,18 +37,22 @@ Stats::Stats()
   // current file stats
   files_in_level.resize(0);
   fade_file_info.resize(0);
+  fade_file_info_micros = 0;
 
   // compaction stats
-  compaction_count = -1;
-  compactions_by_pointer_manipulation = -1;
-  files_read_for_compaction = -1;
-  bytes_read_for_compaction = -1;
-  files_written_after_compaction = -1;
-  bytes_written_after_compaction = -1;
+  compaction_count = 0;
+  compactions_by_pointer_manipulation = 0;
+  bytes_saved_by_pointer_manipulation = 0;
+  files_read_for_compaction = 0;
+  bytes_read_for_compaction = 0;
+  files_written_after_compaction = 0;
+  bytes_written_after_compaction = 0;
+  bytes_flushed = 0;
 
   // consolidated stats
   space_amp = -1;
   write_amp = -1;
+  delete_persistence_threshold = -1;
 
   // latency stats
   //long exp_runtime = -1; // !YBS-sep09-XX!
@@ -56,41 +61,48 @@ Stats::Stats()
   db_open = false;
 }
 
-void Stats::printStats() {
-  DBEnv* _env = DBEnv::GetInstance();
-  
+void Stats::printStats(std::ostream &out) {
+  std::lock_guard<std::mutex> lock(tree_mutex);
   int l = 12;
 
-  std::cout << std::setfill(' ') << std::setw(l-3) << "#p_ts_in_tree" 
+  out << std::setfill(' ') << std::setw(l-3) << "#p_ts_in_tree" 
   << std::setfill(' ') << std::setw(l) << "#kv_in_tree" 
   << std::setfill(' ') << std::setw(l) << "#I_done" 
   << std::setfill(' ') << std::setw(l) << "L_in_tree" 
   << std::setfill(' ') << std::setw(l) << "#U_done" 
   << std::setfill(' ') << std::setw(l) << "#PD_done" 
+  << std::setfill(' ') << std::setw(l) << "#PQ_done" 
+  << std::setfill(' ') << std::setw(l) << "#RQ_done" 
   << std::setfill(' ') << std::setw(l) << "#cmpt" 
   << std::setfill(' ') << std::setw(l) << "#cmpt_easy" 
+  << std::setfill(' ') << std::setw(l) << "bts_easy" 
   << std::setfill(' ') << std::setw(l) << "fls_rd_cmpt" 
   << std::setfill(' ') << std::setw(l) << "fls_wr_cmpt" 
   << std::setfill(' ') << std::setw(l) << "bts_rd_cmpt" 
   << std::setfill(' ') << std::setw(l) << "bts_wr_cmpt" 
+  << std::setfill(' ') << std::setw(l) << "bts_flushed" 
   << "\n";
-  std::cout << std::setfill(' ') << std::setw(l) << point_tombstones_in_tree;
-  std::cout << std::setfill(' ') << std::setw(l) << key_values_in_tree;
-  std::cout << std::setfill(' ') << std::setw(l) << inserts_completed;
-  std::cout << std::setfill(' ') << std::setw(l) << levels_in_tree; 
-  std::cout << std::setfill(' ') << std::setw(l) << updates_completed;
-  std::cout << std::setfill(' ') << std::setw(l) << point_deletes_completed;
-  std::cout << std::setfill(' ') << std::setw(l) << compaction_count;
-  std::cout << std::setfill(' ') << std::setw(l) << compactions_by_pointer_manipulation;
-  std::cout << std::setfill(' ') << std::setw(l) << files_read_for_compaction;
-  std::cout << std::setfill(' ') << std::setw(l) << files_written_after_compaction;
-  std::cout << std::setfill(' ') << std::setw(l) << bytes_read_for_compaction;
-  std::cout << std::setfill(' ') << std::setw(l) << bytes_written_after_compaction;
-
-  std::cout << std::endl;
-
-  std::cout << "files in tree = " << files_in_tree << std::endl;
-  for (int i=0; i<files_in_tree; ++i)
+  out << std::setfill(' ') << std::setw(l) << point_tombstones_in_tree;
+  out << std::setfill(' ') << std::setw(l) << key_values_in_tree;
+  out << std::setfill(' ') << std::setw(l) << inserts_completed;
+  out << std::setfill(' ') << std::setw(l) << levels_in_tree; 
+  out << std::setfill(' ') << std::setw(l) << updates_completed;
+  out << std::setfill(' ') << std::setw(l) << point_deletes_completed;
+  out << std::setfill(' ') << std::setw(l) << point_queries_completed;
+  out << std::setfill(' ') << std::setw(l) << range_queries_completed;
+  out << std::setfill(' ') << std::setw(l) << compaction_count;
+  out << std::setfill(' ') << std::setw(l) << compactions_by_pointer_manipulation;
+  out << std::setfill(' ') << std::setw(l) << bytes_saved_by_pointer_manipulation;
+  out << std::setfill(' ') << std::setw(l) << files_read_for_compaction;
+  out << std::setfill(' ') << std::setw(l) << files_written_after_compaction;
+  out << std::setfill(' ') << std::setw(l) << bytes_read_for_compaction;
+  out << std::setfill(' ') << std::setw(l) << bytes_written_after_compaction;
+  out << std::setfill(' ') << std::setw(l) << bytes_flushed;
+
+  out << std::endl;
+
+  out << "files in tree = " << files_in_tree << std::endl;
+  // for (int i=0; i<files_in_tree; ++i)
     // if (fade_file_info[i].file_ttl_expired)
     // std::cout << "file_id = " << fade_file_info[i].file_id << " level = " << fade_file_info[i].file_level 
     //         << " entry_count = " << fade_file_info[i].file_entry_count << " tombstone_count = " << fade_file_info[i].file_tombstone_count 
@@ -100,25 +112,63 @@ void Stats::printStats() {
   // std::cout << "point_tombstones_in_tree = " << point_tombstones_in_tree << std::endl;
   // std::cout << "updates_completed = " << updates_completed << std::endl;
   // std::cout << "inserts_completed = " << inserts_completed << std::endl;
-  update_proportion = (float) updates_completed / (float) inserts_completed;
+  update_proportion = inserts_completed > 0 ? (float) updates_completed / (float) inserts_completed : 0;
   // std::cout << "update_proportion = " << update_proportion << std::endl;
   float superfluous_bytes = (float) point_tombstones_in_tree * ( (key_size + 1));// + (key_size + value_size)*(1 + update_proportion) );
   float unique_bytes = (inserts_completed - point_deletes_completed) * (key_size + value_size);
-  space_amp = 100 * superfluous_bytes / unique_bytes; 
+  space_amp = unique_bytes > 0 ? 100 * superfluous_bytes / unique_bytes : 0; 
+  // flushed bytes are written once, compactions write them again
+  write_amp = bytes_flushed > 0 ? (float) (bytes_flushed + bytes_written_after_compaction) / (float) bytes_flushed : 0;
 
   // std::cout << "superfluous_bytes = " << superfluous_bytes << std::endl;
   // std::cout << "unique_bytes = " << unique_bytes << std::endl;
 
-  std::cout << std::setfill(' ') << std::setw(l-3) 
+  out << std::setfill(' ') << std::setw(l-3) 
     << "\%space_amp" << std::setfill(' ') << std::setw(l) 
+    << "write_amp" << std::setfill(' ') << std::setw(l) 
     << "dpth" << std::setfill(' ') << std::setw(l+7) 
     << "exp_runtime (ms)" << "\n"; // !YBS-sep09-XX!
-  std::cout << std::setfill(' ') << std::setw(l-3) << space_amp;
-  // std::cout << std::setfill(' ') << std::setw(l) << _env->delete_persistence_latency; // !YBS-feb15-XX!
-  std::cout << std::setfill(' ') << std::setw(l+7) << std::fixed << std::setprecision(2) // !YBS-sep09-XX!
+  out << std::setfill(' ') << std::setw(l-3) << space_amp;
+  out << std::setfill(' ') << std::setw(l) << write_amp;
+  out << std::setfill(' ') << std::setw(l) << delete_persistence_threshold;
+  out << std::setfill(' ') << std::setw(l+7) << std::fixed << std::setprecision(2) // !YBS-sep09-XX!
     /*<< static_cast<double>(exp_runtime)/1000000*/; // !YBS-sep09-XX!
-  std::cout << std::endl;
+  out << std::defaultfloat << std::endl;
+
+}
 
+void Stats::printFadeFileInfo(std::ostream &out) {
+  std::lock_guard<std::mutex> lock(tree_mutex);
+  std::vector<long> tombstones, entries;
+  std::vector<double> oldest;
+  for (auto &file : fade_file_info) {
+    if (file.file_level >= (int)tombstones.size()) {
+      tombstones.resize(file.file_level + 1, 0);
+      entries.resize(file.file_level + 1, 0);
+      oldest.resize(file.file_level + 1, -1);
+    }
+    tombstones[file.file_level] += file.file_tombstone_count;
+    entries[file.file_level] += file.file_entry_count;
+    oldest[file.file_level] =
+        std::max(oldest[file.file_level], file.oldest_tombstone_age);
+  }
+  for (size_t i = 0; i < tombstones.size(); i++) {
+    out << "[Tombstones] level=" << i << " entries=" << entries[i]
+        << " tombstones=" << tombstones[i] << " oldest_tombstone_age_s="
+        << oldest[i] << std::endl;
+  }
+  for (auto &file : fade_file_info) {
+    if (file.file_tombstone_count == 0) {
+      continue;
+    }
+    out << "[Tombstones] file=" << file.file_id << " level="
+        << file.file_level << " entries=" << file.file_entry_count
+        << " point_tombstones=" << file.file_point_tombstone_count
+        << " range_tombstones=" << file.file_range_tombstone_count
+        << " size=" << file.file_size << " file_age_s=" << file.file_age
+        << " oldest_tombstone_age_s=" << file.oldest_tombstone_age
+        << " expired=" << file.file_ttl_expired << std::endl;
+  }
 }
 
 Stats* Stats::getInstance()
@@ -0,0 +1,165 @@
+#include "stats_collector.h"
+
+#include <map>
+#include <sstream>
+
+#include "tombstone_collector.h"
+
+namespace {
+long ReadCount(const UserCollectedProperties &props, const char *name) {
+  auto it = props.find(name);
+  return it == props.end() ? 0 : std::stol(it->second);
+}
+
+std::string BaseName(const std::string &path) {
+  size_t pos = path.find_last_of('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+} // namespace
+
+StatsCollector::StatsCollector(long interval_ms)
+    : interval_ms_(interval_ms), start_(std::chrono::steady_clock::now()) {
+  if (interval_ms_ > 0) {
+    buffer_ = std::make_unique<Buffer>("stats_live.log");
+  }
+}
+
+StatsCollector::~StatsCollector() { Stop(); }
+
+void StatsCollector::OnFlushCompleted(DB *db, const FlushJobInfo &fji) {
+  const TableProperties &props = fji.table_properties;
+  Stats::getInstance()->bytes_flushed +=
+      props.data_size + props.index_size + props.filter_size;
+}
+
+void StatsCollector::OnCompactionCompleted(DB *db,
+                                           const CompactionJobInfo &ci) {
+  if (!ci.status.ok()) {
+    return;
+  }
+  Stats *stats = Stats::getInstance();
+  stats->compaction_count++;
+  stats->files_read_for_compaction += ci.stats.num_input_files;
+  stats->bytes_read_for_compaction += ci.stats.total_input_bytes;
+  stats->files_written_after_compaction += ci.stats.num_output_files;
+  stats->bytes_written_after_compaction += ci.stats.total_output_bytes;
+}
+
+void StatsCollector::Start(DB *db) {
+  if (interval_ms_ <= 0 || thread_.joinable()) {
+    return;
+  }
+  stop_ = false;
+  thread_ = std::thread(&StatsCollector::Run, this, db);
+}
+
+void StatsCollector::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void StatsCollector::Run(DB *db) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, std::chrono::milliseconds(interval_ms_),
+                       [this] { return stop_; })) {
+    Refresh(db);
+    std::ostringstream snapshot;
+    Stats::getInstance()->printStats(snapshot);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+    (*buffer_) << "[Stats] elapsed_ms=" << elapsed << std::endl
+               << snapshot.str();
+    // long runs are watched while they go, do not wait for the buffer limit
+    buffer_->flush();
+  }
+}
+
+void StatsCollector::Refresh(DB *db) {
+  ColumnFamilyMetaData cf_meta;
+  db->GetColumnFamilyMetaData(&cf_meta);
+
+  int levels = 0;
+  long files = 0, entries = 0, deletions = 0;
+  std::vector<int> files_in_level;
+  std::map<std::string, int> level_of;
+  for (auto &level : cf_meta.levels) {
+    files_in_level.push_back(level.files.size());
+    files += level.files.size();
+    if (!level.files.empty()) {
+      levels = level.level + 1;
+    }
+    for (auto &file : level.files) {
+      entries += file.num_entries;
+      deletions += file.num_deletions;
+      level_of[BaseName(file.name)] = level.level;
+    }
+  }
+
+  // range tombstones and the average key/value sizes are only in the
+  // table properties
+  long range_deletions = 0;
+  uint64_t raw_key_size = 0, raw_value_size = 0, num_entries = 0;
+  std::vector<FadeFileInfo> fade_file_info;
+  uint64_t now_micros = SeqnoTimeMap::NowMicros();
+  TablePropertiesCollection props;
+  if (db->GetPropertiesOfAllTables(&props).ok()) {
+    for (auto &table : props) {
+      const TableProperties &tp = *table.second;
+      range_deletions += tp.num_range_deletions;
+      raw_key_size += tp.raw_key_size;
+      raw_value_size += tp.raw_value_size;
+      num_entries += tp.num_entries;
+
+      auto level = level_of.find(BaseName(table.first));
+      if (level == level_of.end()) {
+        continue;
+      }
+      const UserCollectedProperties &user = tp.user_collected_properties;
+      FadeFileInfo info;
+      info.file_id = level->first;
+      info.file_level = level->second;
+      info.file_entry_count = tp.num_entries;
+      info.file_point_tombstone_count =
+          ReadCount(user, TombstoneCollector::kPointTombstones);
+      info.file_range_tombstone_count =
+          ReadCount(user, TombstoneCollector::kRangeTombstones);
+      info.file_tombstone_count =
+          info.file_point_tombstone_count + info.file_range_tombstone_count;
+      info.file_size = tp.data_size + tp.index_size + tp.filter_size;
+      info.file_age = tp.file_creation_time > 0
+                          ? now_micros / 1e6 - tp.file_creation_time
+                          : -1;
+      uint64_t oldest = std::stoull(
+          user.count(TombstoneCollector::kOldestTombstoneTime)
+              ? user.at(TombstoneCollector::kOldestTombstoneTime)
+              : "0");
+      info.oldest_tombstone_age =
+          oldest > 0 && oldest <= now_micros ? (now_micros - oldest) / 1e6
+                                             : -1;
+      info.file_ttl_expired = false;
+      fade_file_info.push_back(info);
+    }
+  }
+
+  Stats *stats = Stats::getInstance();
+  std::lock_guard<std::mutex> lock(stats->tree_mutex);
+  stats->levels_in_tree = levels;
+  stats->files_in_tree = files;
+  stats->files_in_level = files_in_level;
+  stats->key_values_in_tree = entries - deletions;
+  stats->point_tombstones_in_tree = deletions;
+  stats->range_tombstones_in_tree = range_deletions;
+  stats->fade_file_info = fade_file_info;
+  stats->fade_file_info_micros = now_micros;
+  if (num_entries > 0) {
+    stats->key_size = raw_key_size / num_entries;
+    stats->value_size = raw_value_size / num_entries;
+  }
+}
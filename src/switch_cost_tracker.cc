@@ -0,0 +1,123 @@
+#include "switch_cost_tracker.h"
+
+#include <algorithm>
+
+void SwitchCostTracker::BeginSwitch(DB *db, const char *from, const char *to) {
+  if (window_open_) {
+    // a new switch overtook the previous window before its flush finished
+    FinishSwitch(db);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    phase_ = Phase::kInstalled;
+    flush_job_id_ = -1;
+    bytes_copied_ = 0;
+    window_closed_.store(false, std::memory_order_relaxed);
+  }
+
+  window_open_ = true;
+  from_ = from;
+  to_ = to;
+  ops_since_sample_ = 0;
+  window_latency_.Reset();
+  baseline_mem_ = 0;
+  db->GetIntProperty("rocksdb.size-all-mem-tables", &baseline_mem_);
+  peak_mem_ = baseline_mem_;
+  begin_ = std::chrono::steady_clock::now();
+}
+
+void SwitchCostTracker::EndApply() {
+  apply_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - begin_)
+                  .count();
+}
+
+void SwitchCostTracker::CancelSwitch() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  phase_ = Phase::kIdle;
+  window_open_ = false;
+}
+
+void SwitchCostTracker::OnMemTableSealed(const MemTableInfo & /*info*/) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (phase_ == Phase::kInstalled) {
+    // the memtable on the old representation just became immutable
+    phase_ = Phase::kActivated;
+  }
+}
+
+void SwitchCostTracker::OnFlushBegin(DB * /*db*/, const FlushJobInfo &fji) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (phase_ == Phase::kActivated) {
+    phase_ = Phase::kFlushing;
+    flush_job_id_ = fji.job_id;
+  }
+}
+
+void SwitchCostTracker::OnFlushCompleted(DB * /*db*/, const FlushJobInfo &fji) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (phase_ == Phase::kFlushing && fji.job_id == flush_job_id_) {
+    end_ = std::chrono::steady_clock::now();
+    bytes_copied_ = fji.table_properties.raw_key_size +
+                    fji.table_properties.raw_value_size;
+    phase_ = Phase::kIdle;
+    window_closed_.store(true, std::memory_order_release);
+  }
+}
+
+void SwitchCostTracker::SampleMemory(DB *db) {
+  uint64_t mem = 0;
+  if (db->GetIntProperty("rocksdb.size-all-mem-tables", &mem)) {
+    peak_mem_ = std::max(peak_mem_, mem);
+  }
+}
+
+void SwitchCostTracker::FinishSwitch(DB *db) {
+  SampleMemory(db);
+
+  bool complete;
+  std::chrono::steady_clock::time_point end;
+  uint64_t bytes_copied;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    complete = window_closed_.load(std::memory_order_relaxed);
+    end = complete ? end_ : std::chrono::steady_clock::now();
+    bytes_copied = bytes_copied_;
+    phase_ = Phase::kIdle;
+    window_closed_.store(false, std::memory_order_relaxed);
+  }
+  window_open_ = false;
+  num_switches_++;
+
+  uint64_t window_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin_)
+          .count();
+  uint64_t peak_mem_delta = peak_mem_ - baseline_mem_;
+
+  (*buffer_) << "[SwitchCost] switch=" << num_switches_ << " from=" << from_
+             << " to=" << to_ << " complete=" << (complete ? 1 : 0)
+             << " apply_ns=" << apply_ns_ << " duration_ns=" << window_ns
+             << " bytes_copied=" << bytes_copied
+             << " peak_mem_delta=" << peak_mem_delta << " write_latency("
+             << window_latency_.ToString() << ")" << std::endl;
+
+  total_apply_ns_ += apply_ns_;
+  total_window_ns_ += window_ns;
+  total_bytes_copied_ += bytes_copied;
+  max_peak_mem_delta_ = std::max(max_peak_mem_delta_, peak_mem_delta);
+  all_windows_latency_.Merge(window_latency_);
+}
+
+void SwitchCostTracker::PrintSummary(DB *db) {
+  if (window_open_) {
+    FinishSwitch(db);
+  }
+  (*buffer_) << "[SwitchCost] switches: " << num_switches_
+             << ", total_apply_ns: " << total_apply_ns_
+             << ", total_duration_ns: " << total_window_ns_
+             << ", total_bytes_copied: " << total_bytes_copied_
+             << ", max_peak_mem_delta: " << max_peak_mem_delta_
+             << ", write_latency_in_switch(" << all_windows_latency_.ToString()
+             << ")" << std::endl;
+}
@@ -0,0 +1,83 @@
+#include "tombstone_collector.h"
+
+#include <chrono>
+
+SeqnoTimeMap *SeqnoTimeMap::GetInstance() {
+  static SeqnoTimeMap instance;
+  return &instance;
+}
+
+uint64_t SeqnoTimeMap::NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void SeqnoTimeMap::RecordDelete(DB *db) {
+  uint64_t now = NowMicros();
+  // only the replay thread samples, the flag needs no lock
+  if (now < last_sample_micros_ + sample_micros_) {
+    return;
+  }
+  last_sample_micros_ = now;
+  SequenceNumber seqno = db->GetLatestSequenceNumber();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (samples_.size() >= kMaxSamples) {
+    // halve the resolution of the whole history rather than forget its start
+    bool drop = false;
+    for (auto it = samples_.begin(); it != samples_.end(); drop = !drop) {
+      it = drop ? samples_.erase(it) : std::next(it);
+    }
+    sample_micros_ *= 2;
+  }
+  samples_.emplace(seqno, now);
+}
+
+uint64_t SeqnoTimeMap::TimeOf(SequenceNumber seqno) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // the latest sample at or before `seqno` was taken less than one sample
+  // period before it was written
+  auto it = samples_.upper_bound(seqno);
+  if (it == samples_.begin()) {
+    return 0;
+  }
+  return std::prev(it)->second;
+}
+
+const char *TombstoneCollector::kPointTombstones = "fade.point.tombstones";
+const char *TombstoneCollector::kRangeTombstones = "fade.range.tombstones";
+const char *TombstoneCollector::kOldestTombstoneSeqno =
+    "fade.oldest.tombstone.seqno";
+const char *TombstoneCollector::kOldestTombstoneTime =
+    "fade.oldest.tombstone.time";
+
+Status TombstoneCollector::AddUserKey(const Slice & /*key*/,
+                                      const Slice & /*value*/, EntryType type,
+                                      SequenceNumber seq,
+                                      uint64_t /*file_size*/) {
+  switch (type) {
+  case kEntryDelete:
+  case kEntrySingleDelete:
+  case kEntryDeleteWithTimestamp:
+    point_tombstones_++;
+    break;
+  case kEntryRangeDeletion:
+    range_tombstones_++;
+    break;
+  default:
+    return Status::OK();
+  }
+  oldest_seqno_ = std::min(oldest_seqno_, seq);
+  return Status::OK();
+}
+
+Status TombstoneCollector::Finish(UserCollectedProperties *properties) {
+  (*properties)[kPointTombstones] = std::to_string(point_tombstones_);
+  (*properties)[kRangeTombstones] = std::to_string(range_tombstones_);
+  if (point_tombstones_ + range_tombstones_ > 0) {
+    (*properties)[kOldestTombstoneSeqno] = std::to_string(oldest_seqno_);
+    (*properties)[kOldestTombstoneTime] = std::to_string(
+        SeqnoTimeMap::GetInstance()->TimeOf(oldest_seqno_));
+  }
+  return Status::OK();
+}
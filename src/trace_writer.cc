@@ -0,0 +1,182 @@
+#include "trace_writer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+std::atomic<TraceWriter *> TraceWriter::active_{nullptr};
+
+namespace {
+// a writer is only ever active once per process, so the buffer of the
+// calling thread can be cached per thread without an owner check
+thread_local void *tls_buffer = nullptr;
+thread_local TraceWriter *tls_owner = nullptr;
+
+std::string Escape(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+} // namespace
+
+TraceWriter::TraceWriter(const std::string &path, long sample_every)
+    : path_(path),
+      sample_every_(std::max(sample_every, 1L)),
+      start_(std::chrono::steady_clock::now()) {
+  active_.store(this, std::memory_order_release);
+}
+
+TraceWriter::~TraceWriter() {
+  TraceWriter *self = this;
+  active_.compare_exchange_strong(self, nullptr);
+}
+
+const char *TraceWriter::OpName(char operation) {
+  switch (operation) {
+  case 'I':
+    return "insert";
+  case 'U':
+    return "update";
+  case 'D':
+    return "delete";
+  case 'Q':
+    return "point_query";
+  case 'S':
+    return "range_query";
+  default:
+    return "unknown";
+  }
+}
+
+TraceWriter::ThreadBuffer *TraceWriter::GetThreadBuffer() {
+  if (tls_owner != this) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace_back(new ThreadBuffer());
+    // tid 0 is the stall track
+    buffers_.back()->tid = buffers_.size();
+    tls_buffer = buffers_.back().get();
+    tls_owner = this;
+  }
+  return static_cast<ThreadBuffer *>(tls_buffer);
+}
+
+void TraceWriter::Complete(const std::string &name, const char *category,
+                           uint64_t ts_us, uint64_t dur_us,
+                           const std::string &args_json, int tid) {
+  ThreadBuffer *buffer = GetThreadBuffer();
+  buffer->events.push_back({name, category, 'X', ts_us, dur_us,
+                            tid < 0 ? buffer->tid : tid, args_json});
+}
+
+void TraceWriter::Instant(const std::string &name, const char *category,
+                          const std::string &args_json) {
+  ThreadBuffer *buffer = GetThreadBuffer();
+  buffer->events.push_back(
+      {name, category, 'i', NowMicros(), 0, buffer->tid, args_json});
+}
+
+void TraceWriter::OnFlushBegin(DB * /*db*/, const FlushJobInfo &fji) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  flush_start_us_[fji.job_id] = NowMicros();
+}
+
+void TraceWriter::OnFlushCompleted(DB * /*db*/, const FlushJobInfo &fji) {
+  uint64_t now = NowMicros(), start = now;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = flush_start_us_.find(fji.job_id);
+    if (it != flush_start_us_.end()) {
+      start = it->second;
+      flush_start_us_.erase(it);
+    }
+  }
+  std::ostringstream args;
+  args << "\"job\":" << fji.job_id
+       << ",\"entries\":" << fji.table_properties.num_entries
+       << ",\"bytes\":" << fji.table_properties.data_size;
+  Complete("flush", "flush", start, now - start, args.str());
+}
+
+void TraceWriter::OnCompactionBegin(DB * /*db*/, const CompactionJobInfo &ci) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  compaction_start_us_[ci.job_id] = NowMicros();
+}
+
+void TraceWriter::OnCompactionCompleted(DB * /*db*/,
+                                        const CompactionJobInfo &ci) {
+  uint64_t now = NowMicros(), start = now;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = compaction_start_us_.find(ci.job_id);
+    if (it != compaction_start_us_.end()) {
+      start = it->second;
+      compaction_start_us_.erase(it);
+    }
+  }
+  std::ostringstream name, args;
+  name << "compaction L" << ci.base_input_level << "->L" << ci.output_level;
+  args << "\"job\":" << ci.job_id << ",\"input_level\":" << ci.base_input_level
+       << ",\"output_level\":" << ci.output_level
+       << ",\"input_files\":" << ci.input_files.size()
+       << ",\"output_files\":" << ci.output_files.size()
+       << ",\"input_bytes\":" << ci.stats.total_input_bytes
+       << ",\"output_bytes\":" << ci.stats.total_output_bytes
+       << ",\"ok\":" << (ci.status.ok() ? "true" : "false");
+  Complete(name.str(), "compaction", start, now - start, args.str());
+}
+
+void TraceWriter::OnStallConditionsChanged(const WriteStallInfo &info) {
+  uint64_t now = NowMicros();
+  // registering the thread takes mutex_ too, do it before locking
+  ThreadBuffer *buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stalled_) {
+    buffer->events.push_back({stall_stopped_ ? "write stop" : "write delay",
+                              "stall", 'X', stall_start_us_,
+                              now - stall_start_us_, kStallTrack, ""});
+  }
+  stalled_ = info.condition.cur != WriteStallCondition::kNormal;
+  stall_stopped_ = info.condition.cur == WriteStallCondition::kStopped;
+  stall_start_us_ = now;
+}
+
+bool TraceWriter::Write() {
+  std::ofstream out(path_, std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Error[" << __FILE__ << " : " << __LINE__
+              << "]: cannot open trace file " << path_ << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+      << kStallTrack << ",\"args\":{\"name\":\"write stalls\"}}";
+  for (auto &buffer : buffers_) {
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+        << buffer->tid << ",\"args\":{\"name\":\"thread " << buffer->tid
+        << "\"}}";
+    for (auto &event : buffer->events) {
+      out << ",\n{\"name\":\"" << Escape(event.name) << "\",\"cat\":\""
+          << event.category << "\",\"ph\":\"" << event.phase
+          << "\",\"pid\":1,\"tid\":" << event.tid << ",\"ts\":" << event.ts_us;
+      if (event.phase == 'X') {
+        out << ",\"dur\":" << event.dur_us;
+      } else {
+        out << ",\"s\":\"t\"";
+      }
+      if (!event.args_json.empty()) {
+        out << ",\"args\":{" << event.args_json << "}";
+      }
+      out << "}";
+    }
+  }
+  out << "\n]}\n";
+  return out.good();
+}
@@ -0,0 +1,48 @@
+#include "visibility_checker.h"
+
+void VisibilityChecker::OnCompactionCompleted(DB * /*db*/,
+                                              const CompactionJobInfo &ci) {
+  if (ci.status.ok()) {
+    compactions_completed_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void VisibilityChecker::MaybeVerify(DB *db) {
+  if (compactions_verified_ !=
+      compactions_completed_.load(std::memory_order_relaxed)) {
+    Verify(db);
+  }
+}
+
+void VisibilityChecker::Verify(DB *db) {
+  compactions_verified_ = compactions_completed_.load(std::memory_order_relaxed);
+  ReadOptions read_options;
+  std::string value;
+
+  for (auto &entry : expected_) {
+    Status s = db->Get(read_options, entry.first, &value);
+    keys_checked_++;
+
+    bool ok = entry.second.present
+                  ? s.ok() && value == entry.second.value
+                  : s.IsNotFound();
+    if (ok) {
+      continue;
+    }
+
+    if (violations_ < kMaxReportedViolations) {
+      (*buffer_) << "[VisibilityCheck] compaction=" << compactions_verified_
+                 << " key=" << entry.first << " expected="
+                 << (entry.second.present ? entry.second.value : "<deleted>")
+                 << " got=" << (s.ok() ? value : s.ToString()) << std::endl;
+    }
+    violations_++;
+  }
+}
+
+void VisibilityChecker::PrintSummary() {
+  (*buffer_) << "[VisibilityCheck] compactions verified: "
+             << compactions_verified_ << ", sampled keys: " << expected_.size()
+             << ", keys checked: " << keys_checked_
+             << ", violations: " << violations_ << std::endl;
+}
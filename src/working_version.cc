@@ -4,7 +4,10 @@
  */
 #include <memory>
 
+#include <aux_time.h>
+#include <buffer.h>
 #include <db_env.h>
+#include <lsm_simulator.h>
 #include <parse_arguments.h>
 #include <run_workload.h>
 #include <sample_workload.h>
@@ -16,8 +19,14 @@ int main(int argc, char *argv[]) {
     std::cerr << "Failed to parse arguments. Exiting." << std::endl;
     return 1;
   }
+  Buffer::SetMemoryMapped(env->mmap_logs);
+  Buffer::SetCompression(env->compress_logs);
+  my_ticks_calibrate();
 
-  if (env->run_sample_workload) {
+  if (env->simulate_bytes > 0) {
+    printf("Running LSM Simulation....\n");
+    return runSimulation(env);
+  } else if (env->run_sample_workload) {
     printf("Running CS848 Sample Workload....\n");
     return runSampleWorkload(env);
   } else {